@@ -0,0 +1,110 @@
+#include "ProgramGenerator.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// Routines call their predecessor, so codegen needs every earlier prototype
+void routines(std::ostream &out, unsigned size) {
+    out << "program routines;\n\n";
+    for (unsigned i = 0; i < size; i++) {
+        out << "function f" << i << "(n: integer): integer;\n"
+            << "var k: integer;\n"
+            << "begin\n"
+            << "    k := n * " << i % 7 + 1 << " + " << i << ";\n";
+        if (i > 0)
+            out << "    if n > 0 then\n"
+                << "    begin\n"
+                << "        k := k + f" << i - 1 << "(n - 1);\n"
+                << "    end;\n";
+        out << "    f" << i << " := k mod 1000;\n"
+            << "end;\n\n";
+    }
+    out << "begin\n"
+        << "    writeln(f" << size - 1 << "(5));\n"
+        << "end.\n";
+}
+
+// One expression, parenthesised size levels deep
+void nesting(std::ostream &out, unsigned size) {
+    static const char ops[] = {'+', '-', '*'};
+    out << "program nesting;\n\n"
+        << "var x: integer;\n"
+        << "begin\n"
+        << "    x := 1;\n"
+        << "    x := ";
+    for (unsigned i = 0; i < size; i++)
+        out << '(';
+    out << 'x';
+    for (unsigned i = 0; i < size; i++)
+        out << ' ' << ops[i % 3] << ' ' << i % 5 + 1 << ')';
+    out << ";\n"
+        << "    writeln(x);\n"
+        << "end.\n";
+}
+
+// A single main block of size statements
+void block(std::ostream &out, unsigned size) {
+    out << "program block;\n\n"
+        << "var x: integer;\n"
+        << "var y: integer;\n"
+        << "begin\n"
+        << "    x := 0;\n"
+        << "    y := 1;\n";
+    for (unsigned i = 0; i < size; i++) {
+        switch (i % 4) {
+            case 0: out << "    x := x + " << i << " * y;\n"; break;
+            case 1: out << "    y := (x mod 17) + " << i % 13 << ";\n"; break;
+            case 2: out << "    if x > " << i << " then x := x - y;\n"; break;
+            default: out << "    write(x);\n"; break;
+        }
+    }
+    out << "    writeln(x);\n"
+        << "end.\n";
+}
+
+// size constants, each defined by the one before it, so the last one uses all the others indirectly
+void consts(std::ostream &out, unsigned size) {
+    out << "program consts;\n\n"
+        << "const\n"
+        << "    c0 = 1;\n";
+    for (unsigned i = 1; i < size; i++)
+        out << "    c" << i << " = c" << i - 1 << " + 3;\n";
+    out << "begin\n"
+        << "    writeln(c" << size - 1 << " + c0);\n"
+        << "end.\n";
+}
+
+}
+
+std::string generateProgram(ProgramShape shape, unsigned size) {
+    if (size == 0)
+        size = 1;
+    std::ostringstream out;
+    switch (shape) {
+        case ProgramShape::Routines: routines(out, size); break;
+        case ProgramShape::Nesting: nesting(out, size); break;
+        case ProgramShape::Block: block(out, size); break;
+        case ProgramShape::Consts: consts(out, size); break;
+    }
+    return out.str();
+}
+
+const char *shapeName(ProgramShape shape) {
+    switch (shape) {
+        case ProgramShape::Routines: return "routines";
+        case ProgramShape::Nesting: return "nesting";
+        case ProgramShape::Block: return "block";
+        case ProgramShape::Consts: return "consts";
+    }
+    return "";
+}
+
+ProgramShape shapeFromName(const std::string &name) {
+    for (ProgramShape shape : {ProgramShape::Routines, ProgramShape::Nesting, ProgramShape::Block, ProgramShape::Consts}) {
+        if (name == shapeName(shape))
+            return shape;
+    }
+    throw std::invalid_argument("Unknown program shape: " + name);
+}
@@ -0,0 +1,21 @@
+#ifndef MILA_BENCH_PROGRAMGENERATOR_HPP
+#define MILA_BENCH_PROGRAMGENERATOR_HPP
+
+#include <string>
+
+/**
+ * @brief Synthetic Mila programs whose size grows along one dimension, for the compiler benchmarks.
+ *
+ * Every shape stresses another part of the compiler: many routines calling each other, one deeply nested
+ * expression, one long block of statements and a large const section. The programs are valid and deterministic,
+ * so they can also be compiled and run.
+ */
+enum class ProgramShape { Routines, Nesting, Block, Consts };
+
+std::string generateProgram(ProgramShape shape, unsigned size);
+
+const char *shapeName(ProgramShape shape);
+/// Throws std::invalid_argument for an unknown name
+ProgramShape shapeFromName(const std::string &name);
+
+#endif // MILA_BENCH_PROGRAMGENERATOR_HPP
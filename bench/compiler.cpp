@@ -0,0 +1,170 @@
+/*
+ * Throughput of the compiler phases on generated programs (see ProgramGenerator.hpp), one benchmark per phase and
+ * program shape over a range of sizes. Each reports the big-O fit over its sizes, so quadratic behaviour shows up
+ * as N^2 instead of N, and tokens per second for comparing builds.
+ *
+ *   ./mila-bench                                        all of them
+ *   ./mila-bench --benchmark_filter='Parse/nesting'      one phase and shape
+ *   ./mila-bench --benchmark_format=json > run.json      for comparing runs with google-benchmark's compare.py
+ *
+ * Lex runs the lexer alone, Parse the parser with the lexer it drives, Codegen Parser::Generate (codegen,
+ * verification, runtime linking and effect analysis), EmitIR prints the module and EmitObject compiles it to an
+ * object file.
+ */
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+#include <llvm/Support/raw_ostream.h>
+
+// Parser.hpp first, Token.hpp shares its include guard
+#include "Parser.hpp"
+#include "ObjectEmitter.hpp"
+#include "ProgramGenerator.hpp"
+
+namespace {
+
+unsigned countTokens(const std::string &source) {
+    std::istringstream input(source);
+    Lexer lexer(input);
+    unsigned tokens = 0;
+    while (lexer.gettok() != tok_eof)
+        tokens++;
+    return tokens;
+}
+
+/// A parser that has parsed source, the setup of the later phases
+std::unique_ptr<Parser> parsed(const std::string &source, std::istringstream &input) {
+    input.str(source);
+    auto parser = std::make_unique<Parser>(input);
+    parser->Parse();
+    return parser;
+}
+
+void setCounters(benchmark::State &state, const std::string &source) {
+    unsigned tokens = countTokens(source);
+    state.SetComplexityN(state.range(0));
+    state.counters["tokens"] = tokens;
+    state.counters["tokens/s"] = benchmark::Counter(tokens, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+void Lex(benchmark::State &state, ProgramShape shape) {
+    std::string source = generateProgram(shape, state.range(0));
+    for (auto _ : state) {
+        std::istringstream input(source);
+        Lexer lexer(input);
+        while (lexer.gettok() != tok_eof) {
+        }
+    }
+    setCounters(state, source);
+}
+
+void Parse(benchmark::State &state, ProgramShape shape) {
+    std::string source = generateProgram(shape, state.range(0));
+    for (auto _ : state) {
+        std::istringstream input(source);
+        Parser parser(input);
+        benchmark::DoNotOptimize(parser.Parse());
+    }
+    setCounters(state, source);
+}
+
+void Codegen(benchmark::State &state, ProgramShape shape) {
+    std::string source = generateProgram(shape, state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::istringstream input;
+        auto parser = parsed(source, input);
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(&parser->Generate());
+        state.PauseTiming();
+        parser.reset();
+        state.ResumeTiming();
+    }
+    setCounters(state, source);
+}
+
+void EmitIR(benchmark::State &state, ProgramShape shape) {
+    std::string source = generateProgram(shape, state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::istringstream input;
+        auto parser = parsed(source, input);
+        llvm::Module &module = parser->Generate();
+        std::string ir;
+        state.ResumeTiming();
+        llvm::raw_string_ostream out(ir);
+        module.print(out, nullptr);
+        out.flush();
+        state.PauseTiming();
+        parser.reset();
+        state.ResumeTiming();
+    }
+    setCounters(state, source);
+}
+
+void EmitObject(benchmark::State &state, ProgramShape shape) {
+    std::string source = generateProgram(shape, state.range(0));
+    std::string path = "/tmp/mila-bench-" + std::to_string(getpid()) + ".o";
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::istringstream input;
+        auto parser = parsed(source, input);
+        llvm::Module &module = parser->Generate();
+        state.ResumeTiming();
+        emitObject(module, path);
+        state.PauseTiming();
+        parser.reset();
+        state.ResumeTiming();
+    }
+    std::remove(path.c_str());
+    setCounters(state, source);
+}
+
+// Sizes per shape: the largest takes a fraction of a second to compile in a debug build
+struct ShapeRange {
+    ProgramShape shape;
+    int smallest, largest;
+};
+const ShapeRange Shapes[] = {
+    {ProgramShape::Routines, 32, 512},
+    {ProgramShape::Nesting, 16, 256},
+    {ProgramShape::Block, 128, 2048},
+    {ProgramShape::Consts, 128, 2048},
+};
+
+void registerPhase(const char *phase, void (*run)(benchmark::State &, ProgramShape)) {
+    for (const ShapeRange &range : Shapes) {
+        std::string name = std::string(phase) + "/" + shapeName(range.shape);
+        benchmark::RegisterBenchmark(name.c_str(), run, range.shape)
+            ->RangeMultiplier(2)
+            ->Range(range.smallest, range.largest)
+            ->Unit(benchmark::kMicrosecond)
+            ->Complexity();
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    // The parser's tracing would be most of what is measured
+    std::clog.rdbuf(nullptr);
+
+    registerPhase("Lex", Lex);
+    registerPhase("Parse", Parse);
+    registerPhase("Codegen", Codegen);
+    registerPhase("EmitIR", EmitIR);
+    registerPhase("EmitObject", EmitObject);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
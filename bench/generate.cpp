@@ -0,0 +1,24 @@
+/*
+ * Writes a synthetic Mila program to stdout, the same ones mila-bench compiles.
+ *
+ *   ./mila-gen routines|nesting|block|consts SIZE > program.mila
+ */
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+#include "ProgramGenerator.hpp"
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " routines|nesting|block|consts SIZE" << std::endl;
+        return 1;
+    }
+    try {
+        std::cout << generateProgram(shapeFromName(argv[1]), static_cast<unsigned>(std::atoi(argv[2])));
+    } catch (const std::invalid_argument &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
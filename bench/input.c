@@ -0,0 +1,63 @@
+/*
+ * Compares readln from fce.c with the scanf("%d") readln used before.
+ *
+ *   ./fce-input-bench generate 10000000 > ints.txt
+ *   ./fce-input-bench scanf|readln < ints.txt       (regular file, mapped by the runtime)
+ *   cat ints.txt | ./fce-input-bench scanf|readln   (pipe, read in blocks)
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int readln(int *x);
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s generate COUNT | scanf | readln\n", argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "generate") == 0) {
+        int count = argc > 2 ? atoi(argv[2]) : 10000000;
+        printf("%d\n", count);
+        unsigned int state = 12345;
+        for (int i = 0; i < count; i++) {
+            state = state * 1103515245u + 12345u;
+            printf("%d\n", (int) (state >> 1) - (1 << 30));
+        }
+        return 0;
+    }
+
+    int count = 0;
+    long long sum = 0;
+    double start = now();
+    if (strcmp(argv[1], "scanf") == 0) {
+        scanf("%d", &count);
+        for (int i = 0, x = 0; i < count; i++) {
+            scanf("%d", &x);
+            sum += x;
+        }
+    } else if (strcmp(argv[1], "readln") == 0) {
+        readln(&count);
+        for (int i = 0, x = 0; i < count; i++) {
+            readln(&x);
+            sum += x;
+        }
+    } else {
+        fprintf(stderr, "unknown mode %s\n", argv[1]);
+        return 1;
+    }
+    double elapsed = now() - start;
+
+    fprintf(stderr, "%s: %d integers in %.3f s (%.1f M/s), sum %lld\n",
+            argv[1], count, elapsed, count / elapsed * 1e-6, sum);
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Runs a program several times and prints the median wall time in nanoseconds and the median number of user-space
+ * instructions it retired, counted with perf_event_open(2). Where hardware counters are not available (containers,
+ * perf_event_paranoid > 2) the instruction count is -1.
+ *
+ *   ./mila-measure [-r RUNS] [-i INPUT] PROGRAM [ARGS...]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare(const void *a, const void *b) {
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static int64_t median(int64_t *values, int count) {
+    qsort(values, (size_t) count, sizeof(*values), compare);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+/* Counter following pid from its exec on, -1 when the kernel or the machine cannot count instructions */
+static int openCounter(pid_t pid) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* One run, returns 0 when the program exited successfully */
+static int run(char **argv, const char *input, int64_t *wall, int64_t *instructions) {
+    int go[2];
+    if (pipe(go) != 0)
+        return -1;
+    pid_t pid = fork();
+    if (pid < 0)
+        return -1;
+    if (pid == 0) {
+        /* Waits until the parent attached the counter, so the whole run is counted */
+        char c;
+        close(go[1]);
+        if (read(go[0], &c, 1) != 1)
+            _exit(127);
+        int in = open(input ? input : "/dev/null", O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if (in < 0 || out < 0)
+            _exit(127);
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    close(go[0]);
+    int counter = openCounter(pid);
+    double start = now();
+    if (write(go[1], "x", 1) != 1)
+        return -1;
+    close(go[1]);
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    *wall = (int64_t) ((now() - start) * 1e9);
+
+    uint64_t count;
+    *instructions = -1;
+    if (counter >= 0 && read(counter, &count, sizeof(count)) == sizeof(count))
+        *instructions = (int64_t) count;
+    if (counter >= 0)
+        close(counter);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    int runs = 5;
+    const char *input = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "+r:i:")) != -1) {
+        switch (opt) {
+            case 'r': runs = atoi(optarg); break;
+            case 'i': input = optarg; break;
+            default: goto usage;
+        }
+    }
+    if (optind >= argc || runs < 1)
+        goto usage;
+
+    int64_t *walls = malloc(sizeof(int64_t) * (size_t) runs);
+    int64_t *instructions = malloc(sizeof(int64_t) * (size_t) runs);
+    for (int i = 0; i < runs; i++) {
+        if (run(argv + optind, input, &walls[i], &instructions[i]) != 0) {
+            fprintf(stderr, "%s: %s failed\n", argv[0], argv[optind]);
+            return 1;
+        }
+    }
+    printf("%lld %lld\n", (long long) median(walls, runs), (long long) median(instructions, runs));
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-r RUNS] [-i INPUT] PROGRAM [ARGS...]\n", argv[0]);
+    return 1;
+}
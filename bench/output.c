@@ -0,0 +1,36 @@
+/*
+ * Compares writeln from fce.c with the printf("%d\n") it replaced.
+ * Run with stdout redirected, e.g. ./fce-output-bench 10000000 > /dev/null
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+void writeln(int x);
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 10000000;
+
+    double start = now();
+    for (int i = 0; i < count; i++)
+        printf("%d\n", i * 7919 - count);
+    fflush(stdout);
+    double printfTime = now() - start;
+
+    start = now();
+    for (int i = 0; i < count; i++)
+        writeln(i * 7919 - count);
+    /* at most one buffer is still pending, the runtime flushes it at exit */
+    double writelnTime = now() - start;
+
+    fprintf(stderr, "%d lines: printf %.3f s, writeln %.3f s (%.1fx)\n",
+            count, printfTime, writelnTime, printfTime / writelnTime);
+    return 0;
+}
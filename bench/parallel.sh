@@ -0,0 +1,69 @@
+#!/bin/bash
+# Scaling of parallel for: compiles bench/programs/parallelPrimes.mila once and runs it with MILA_THREADS set to
+# 1, 2, 4, ... and the number of processors, printing the median wall time, the speedup over one thread and the
+# parallel efficiency (speedup per thread). Exits with 1 when a thread count prints another result than one thread.
+#
+#   bench/parallel.sh [-r RUNS] [-n INPUT] [-t "1 2 4"] [-O LEVEL] [-m MILA_MEASURE]
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" >/dev/null 2>&1 && pwd )"
+
+set -o errexit -o pipefail -o nounset
+
+Runs=5
+Input=3000000
+Level=2
+Measure="$DIR/../build/mila-measure"
+Processors=$(getconf _NPROCESSORS_ONLN)
+Threads=""
+for (( t = 1; t < Processors; t *= 2 )); do
+    Threads+="$t "
+done
+Threads+="$Processors"
+while getopts "r:n:t:O:m:" opt; do
+    case "$opt" in
+        r) Runs="$OPTARG" ;;
+        n) Input="$OPTARG" ;;
+        t) Threads="$OPTARG" ;;
+        O) Level="$OPTARG" ;;
+        m) Measure="$OPTARG" ;;
+        *) exit 2 ;;
+    esac
+done
+
+if [[ ! -x "$Measure" ]]; then
+    echo "$0: $Measure not found, build it first: cmake --build build --target mila-measure" >&2
+    exit 2
+fi
+
+WorkDir=$(mktemp -d)
+trap 'rm -rf "$WorkDir"' EXIT
+
+exe="$WorkDir/parallelPrimes"
+if ! "$DIR/../mila" "-O$Level" "$DIR/programs/parallelPrimes.mila" -o "$exe" > "$WorkDir/compile.log" 2>&1; then
+    cat "$WorkDir/compile.log" >&2
+    exit 2
+fi
+echo "$Input" > "$WorkDir/input"
+
+failed=0
+base=""
+expected=""
+echo "parallelPrimes $Input at -O$Level, $Processors processors, median of $Runs runs"
+printf '%8s %12s %9s %11s  %s\n' threads "median ms" speedup efficiency status
+for threads in $Threads; do
+    export MILA_THREADS=$threads
+    output=$("$exe" < "$WorkDir/input" | tr '\n' ' ')
+    read -r wall instructions < <("$Measure" -r "$Runs" -i "$WorkDir/input" "$exe")
+    [[ -z "$base" ]] && base=$wall expected=$output
+
+    status=ok
+    if [[ "$output" != "$expected" ]]; then
+        status="WRONG RESULT $output, expected $expected"
+        failed=1
+    fi
+    # Hundredths, bash has no floating point
+    speedup=$(( base * 100 / wall ))
+    efficiency=$(( speedup / threads ))
+    printf '%8d %8d.%03d %6d.%02d %10d%%  %s\n' "$threads" $(( wall / 1000000 )) $(( wall / 1000 % 1000 )) \
+        $(( speedup / 100 )) $(( speedup % 100 )) "$efficiency" "$status"
+done
+exit $failed
@@ -0,0 +1,118 @@
+#!/bin/bash
+# Speed of the generated code: compiles the programs in bench/programs at every optimisation level, runs each with a
+# large input and compares the median wall time and instruction count with a stored baseline. The instruction
+# count is compared where both runs have one (perf_event), it hardly depends on the load of the machine; the wall
+# time otherwise. Exits with 1 when an entry got slower than the threshold allows or printed another result.
+#
+#   bench/runtime.sh [-r RUNS] [-t PERCENT] [-l "0 1 2 3"] [-b BASELINE] [-m MILA_MEASURE] [-u]
+#
+# -u writes the measured values as the new baseline. The threshold defaults to $MILA_BENCH_THRESHOLD or 10 %.
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" >/dev/null 2>&1 && pwd )"
+
+set -o errexit -o pipefail -o nounset
+
+# program and its input
+Programs=(
+    "isprime 2000000"
+    "fibonacci 34"
+    "gcd 1400"
+    "factorization 150000"
+)
+
+Runs=5
+Threshold="${MILA_BENCH_THRESHOLD:-10}"
+Levels="0 1 2 3"
+Baseline="$DIR/runtime-baseline.txt"
+Measure="$DIR/../build/mila-measure"
+Update=n
+while getopts "r:t:l:b:m:u" opt; do
+    case "$opt" in
+        r) Runs="$OPTARG" ;;
+        t) Threshold="$OPTARG" ;;
+        l) Levels="$OPTARG" ;;
+        b) Baseline="$OPTARG" ;;
+        m) Measure="$OPTARG" ;;
+        u) Update=y ;;
+        *) exit 2 ;;
+    esac
+done
+
+if [[ ! -x "$Measure" ]]; then
+    echo "$0: $Measure not found, build it first: cmake --build build --target mila-measure" >&2
+    exit 2
+fi
+
+WorkDir=$(mktemp -d)
+trap 'rm -rf "$WorkDir"' EXIT
+
+# name level -> "wall_ns instructions output"
+declare -A Base=()
+if [[ -f "$Baseline" ]]; then
+    while read -r name level wall instructions output; do
+        [[ -z "$name" || "$name" == \#* ]] && continue
+        Base["$name $level"]="$wall $instructions $output"
+    done < "$Baseline"
+fi
+
+# Change against the baseline in tenths of a percent
+change() {
+    echo $(( ($1 - $2) * 1000 / $2 ))
+}
+
+percent() {
+    local sign="" value=$1
+    if (( value < 0 )); then sign="-"; value=$(( -value )); fi
+    printf '%s%d.%d%%' "$sign" $(( value / 10 )) $(( value % 10 ))
+}
+
+Measured=()
+failed=0
+printf '%-15s %5s %12s %16s %10s  %s\n' program level "median ms" instructions change status
+for entry in "${Programs[@]}"; do
+    read -r name input <<< "$entry"
+    echo "$input" > "$WorkDir/$name.in"
+    for level in $Levels; do
+        exe="$WorkDir/$name-O$level"
+        if ! "$DIR/../mila" "-O$level" "$DIR/programs/$name.mila" -o "$exe" > "$WorkDir/compile.log" 2>&1; then
+            cat "$WorkDir/compile.log" >&2
+            exit 2
+        fi
+        output=$("$exe" < "$WorkDir/$name.in")
+        read -r wall instructions < <("$Measure" -r "$Runs" -i "$WorkDir/$name.in" "$exe")
+        Measured+=("$name O$level $wall $instructions $output")
+
+        status=ok difference=""
+        if [[ -n "${Base["$name O$level"]-}" ]]; then
+            read -r baseWall baseInstructions baseOutput <<< "${Base["$name O$level"]}"
+            if (( instructions > 0 && baseInstructions > 0 )); then
+                diff=$(change "$instructions" "$baseInstructions")
+                difference="$(percent "$diff") instr"
+            else
+                diff=$(change "$wall" "$baseWall")
+                difference="$(percent "$diff") time"
+            fi
+            if [[ "$output" != "$baseOutput" ]]; then
+                status="WRONG RESULT $output, expected $baseOutput"
+                failed=1
+            elif (( diff > Threshold * 10 )); then
+                status=REGRESSION
+                failed=1
+            fi
+        else
+            status="no baseline"
+        fi
+        printf '%-15s %5s %12d.%03d %16s %10s  %s\n' "$name" "O$level" $(( wall / 1000000 )) $(( wall / 1000 % 1000 )) \
+            "$instructions" "$difference" "$status"
+    done
+done
+
+if [[ $Update == y ]]; then
+    {
+        echo "# program level median_wall_ns instructions output"
+        echo "# $(uname -m), $(grep -m 1 'model name' /proc/cpuinfo | cut -d: -f2- | sed 's/^ *//'), $Runs runs"
+        printf '%s\n' "${Measured[@]}"
+    } >| "$Baseline"
+    echo "Baseline written to $Baseline"
+    exit 0
+fi
+exit $failed
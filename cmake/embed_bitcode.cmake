@@ -0,0 +1,25 @@
+# Turns the runtime bitcode into a C++ source the compiler is linked with.
+#   cmake -D input=<fce.bc or empty> -D output=<RuntimeBitcode.cpp> -P embed_bitcode.cmake
+# Without input (no clang at configure time) the embedded runtime is empty and Mila programs
+# keep calling the separately compiled fce.c.
+
+if(NOT output)
+   message(FATAL_ERROR "Variable output not defined")
+endif()
+
+set(bytes "")
+set(size 0)
+if(input)
+	file(READ "${input}" hex HEX)
+	string(LENGTH "${hex}" hexLength)
+	math(EXPR size "${hexLength} / 2")
+	string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+endif()
+
+file(WRITE "${output}.tmp"
+	"// Generated by cmake/embed_bitcode.cmake from src/fce.c, do not edit\n"
+	"#include <cstddef>\n\n"
+	"extern const unsigned char milaRuntimeBitcode[] = {${bytes}0};\n"
+	"extern const std::size_t milaRuntimeBitcodeSize = ${size};\n")
+configure_file("${output}.tmp" "${output}" COPYONLY)
+file(REMOVE "${output}.tmp")
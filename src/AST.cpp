@@ -3,6 +3,17 @@
 //
 
 #include "AST.hpp"
+#include "DebugInfo.hpp"
+#include "SourceProfile.hpp"
+
+#include <limits>
+#include <tuple>
+
+size_t AST::countNodes() const {
+    size_t count = 1;
+    forEachChild([&count](const AST &child) { count += child.countNodes(); });
+    return count;
+}
 
 BlockAST::BlockAST(std::vector<std::unique_ptr<AST>> body) : m_Body(std::move(body)) {}
 
@@ -17,20 +28,83 @@ void BlockAST::print(std::ostream &out, int indent) const {
     }
     out << std::string(indent, ' ') << "}";
 }
+// Instructions generated from now on belong to node (-g)
+static void emitLocation(GenContext &gen, const AST &node) {
+    if (gen.debugInfo)
+        gen.debugInfo->setLocation(gen.builder, node.getPosition());
+}
+
 llvm::Value * BlockAST::codegen(GenContext& gen) {
     for(auto & expression : m_Body) {
+        emitLocation(gen, *expression);
         expression->codegen(gen);
     }
     return nullptr;
 };
+void BlockAST::markTailCalls(const PrototypeAST &proto, bool tail) {
+    for (size_t i = 0; i < m_Body.size(); i++) {
+        // A statement is in tail position when it ends a tail block or is followed by exit
+        bool last = i + 1 == m_Body.size();
+        bool beforeExit = !last && dynamic_cast<FunctionExitAST *>(m_Body[i + 1].get()) != nullptr;
+        m_Body[i]->markTailCalls(proto, (last && tail) || beforeExit);
+    }
+}
+void BlockAST::collectCallees(std::set<std::string> &callees) const {
+    for (const auto &stmt : m_Body)
+        stmt->collectCallees(callees);
+}
+void BlockAST::forEachChild(const std::function<void(const AST &)> &visit) const {
+    for (const auto &stmt : m_Body)
+        visit(*stmt);
+}
 
 TypeAST::TypeAST(Type type) : m_type(type) {};
 //    void print(std::ostream& os, unsigned indent = 0) const override;
 //    llvm::Value* codegen(GenContext& gen) const override;
 void TypeAST::print(std::ostream &out, int indent ) const {
-    out << std::string(indent, ' ') << " Type: " << "INT" << "\n";
+    out << std::string(indent, ' ') << " Type: " << (m_type == Type::DOUBLE ? "REAL" : "INT") << "\n";
 }
 llvm::Value * TypeAST::codegen(GenContext& gen) { return nullptr;};
+llvm::Type * TypeAST::getLLVMType(llvm::LLVMContext &ctx, Type type) {
+    return type == Type::DOUBLE ? llvm::Type::getDoubleTy(ctx) : llvm::Type::getInt32Ty(ctx);
+}
+
+// Stack slot of a variable dec or readln writes to, constants and for variables are rejected like by :=
+static llvm::AllocaInst * writableStore(GenContext &gen, const std::string &name) {
+    auto found = gen.symbTable.find(name);
+    if (found == gen.symbTable.end() || !found->second.store)
+        throw std::runtime_error("Var doesn't exist: " + name);
+    if (found->second.constant)
+        throw std::runtime_error("Trying to change const value");
+    return found->second.store;
+}
+
+static llvm::Value * promoteToReal(GenContext &gen, llvm::Value *V) {
+    if (V->getType()->isDoubleTy())
+        return V;
+    return gen.builder.CreateSIToFP(V, llvm::Type::getDoubleTy(gen.ctx), "realtmp");
+}
+
+// Integers become reals wherever a real is expected, the other way round takes trunc or round
+static llvm::Value * convertValue(GenContext &gen, llvm::Value *V, llvm::Type *To, const std::string &what) {
+    if (V->getType() == To)
+        return V;
+    if (To->isDoubleTy())
+        return promoteToReal(gen, V);
+    throw std::runtime_error("Real value where an integer is expected: " + what + ", use trunc or round");
+}
+
+
+llvm::Value * ExprAST::codegenCondition(GenContext& gen) {
+    // Any non-zero integer is true
+    llvm::Value *V = codegen(gen);
+    if (V->getType()->isDoubleTy())
+        return gen.builder.CreateFCmpUNE(V, llvm::ConstantFP::get(V->getType(), 0.0), "tobool");
+    return gen.builder.CreateICmpNE(V, llvm::ConstantInt::get(V->getType(), 0, true), "tobool");
+}
+void ExprAST::codegenBranch(GenContext& gen, llvm::BasicBlock *TrueBB, llvm::BasicBlock *FalseBB) {
+    gen.builder.CreateCondBr(codegenCondition(gen), TrueBB, FalseBB);
+}
 
 
 NumberExprAST::NumberExprAST(int val) : m_Val(val) {}
@@ -47,6 +121,26 @@ llvm::Value * NumberExprAST::codegen(GenContext& gen) {
 }
 
 
+RealExprAST::RealExprAST(double val) : m_Val(val) {}
+const std::string & RealExprAST::getName() const {
+    static const std::string name;
+    return name;
+}
+
+void RealExprAST::print(std::ostream &out, int indent) const {
+    out << std::string(indent, ' ') << "{\n";
+    out << std::string(indent + 2, ' ') << "\"type\": \"RealExprAST\",\n";
+    // Every bit of the value, incremental compilation tells routines apart by their printed tree
+    std::streamsize precision = out.precision(std::numeric_limits<double>::max_digits10);
+    out << std::string(indent + 2, ' ') << "\"value\": " << m_Val << "\n";
+    out.precision(precision);
+    out << std::string(indent, ' ') << "}";
+}
+llvm::Value * RealExprAST::codegen(GenContext& gen) {
+    return llvm::ConstantFP::get(llvm::Type::getDoubleTy(gen.ctx), m_Val);
+}
+
+
 DeclRefAST::DeclRefAST(std::string var): m_Var(var) {};
 
 const std::string & DeclRefAST::getName() const { return m_Var; };
@@ -64,8 +158,12 @@ llvm::Value * DeclRefAST::codegen(GenContext& gen) {
     if (searchIt == gen.symbTable.end()) {
         throw std::runtime_error("Unknown variable name: " + m_Var);
     }
+    // Symbols bound to an SSA value (loop induction variables) are read directly
+    if (searchIt->second.value)
+        return searchIt->second.value;
     // Return the stored LLVM Value for the variable
-    llvm::Value * val = gen.builder.CreateLoad(llvm::Type::getInt32Ty(gen.ctx), searchIt->second.store, m_Var);
+    llvm::AllocaInst * store = searchIt->second.store;
+    llvm::Value * val = gen.builder.CreateLoad(store->getAllocatedType(), store, m_Var);
 
     return val;
 };
@@ -78,17 +176,43 @@ void VarDeclAST::print(std::ostream &out, int indent) const {
     out << std::string(indent, ' ') << "{\n";
     out << std::string(indent + 2, ' ') << "\"type\": \"VarDeclAST\",\n";
     out << std::string(indent + 2, ' ') << "\"mvar\": "<< m_var;
+    out << ",\n" << std::string(indent + 2, ' ') << "\"constant\": " << (m_constant ? "true" : "false");
+    if (getType() == TypeAST::Type::DOUBLE)
+        out << ",\n" << std::string(indent + 2, ' ') << "\"vartype\": \"real\"";
+    if (m_expr) {
+        out << ",\n" << std::string(indent + 2, ' ') << "\"init\": ";
+        m_expr->print(out, indent + 2);
+    }
 //        out << std::string(indent + 2, ' ') << "\"operator\": \"" << Op << "\",\n";
     out << "\n" << std::string(indent, ' ') << "}";
 };
+void VarDeclAST::collectCallees(std::set<std::string> &callees) const {
+    if (m_expr)
+        m_expr->collectCallees(callees);
+}
+void VarDeclAST::forEachChild(const std::function<void(const AST &)> &visit) const {
+    if (m_type)
+        visit(*m_type);
+    if (m_expr)
+        visit(*m_expr);
+}
 llvm::Value* VarDeclAST::codegen(GenContext &gen) {
     // Generate the type for the variable
 //        llvm::Type* varType = m_type->codegen(gen);
     std::clog << "Codegening VarDeclAST: " << m_var << std::endl;
-    llvm::Type * varType = llvm::Type::getInt32Ty(gen.ctx);
+    llvm::Type * varType = TypeAST::getLLVMType(gen.ctx, getType());
 
-    if (!varType) {
-        throw std::runtime_error("Unknown type for variable: " + m_var);
+    // Initialize the variable if an initializer expression is provided
+    llvm::Value* initVal = nullptr;
+    if (m_expr) {
+        initVal = m_expr->codegen(gen);
+        if (!initVal) {
+            throw std::runtime_error("Failed to generate initializer for variable: " + m_var);
+        }
+        // Constants take the type of their value
+        if (m_constant)
+            varType = initVal->getType();
+        initVal = convertValue(gen, initVal, varType, m_var);
     }
 
     // Create an alloca instruction in the entry block of the function
@@ -96,32 +220,48 @@ llvm::Value* VarDeclAST::codegen(GenContext &gen) {
     llvm::IRBuilder<> tmpBuilder(&function->getEntryBlock(),
                                  function->getEntryBlock().begin());
     llvm::AllocaInst* alloca = tmpBuilder.CreateAlloca(varType, 0, m_var.c_str());
-
-    // Initialize the variable if an initializer expression is provided
-    if (m_expr) {
-        llvm::Value* initVal = m_expr->codegen(gen);
-        if (!initVal) {
-            throw std::runtime_error("Failed to generate initializer for variable: " + m_var);
-        }
-
-        // Ensure the types match
-//            if (initVal->getType() != varType) {
-//                throw std::runtime_error("Type mismatch in initializer for variable: " + m_var);
-//            }
-
+    if (initVal)
         gen.builder.CreateStore(initVal, alloca);
-    }
 
     // Add the variable to the symbol table
+    // Unit constants have no stack slot and may be shadowed by locals
     auto searchIt = gen.symbTable.find(m_var);
-    if(searchIt != gen.symbTable.end()) {
+    if(searchIt != gen.symbTable.end() && searchIt->second.store) {
         throw std::runtime_error("Already exists var: " + m_var);
     }
     gen.symbTable[m_var] = {alloca, m_constant};
+    if (gen.debugInfo)
+        gen.debugInfo->declareVariable(gen.builder, alloca, m_var, getPosition());
 
     return alloca;
 }
 
+int VarDeclAST::codegenUnitConstant(GenContext &gen) {
+    if (gen.globalSymbols.count(m_var)) {
+        throw std::runtime_error("Already exists const: " + m_var);
+    }
+    // The initializer is generated into a scratch routine, anything but a number left after folding is rejected
+    llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getVoidTy(gen.ctx), false);
+    llvm::Function * Scratch = llvm::Function::Create(FT, llvm::Function::InternalLinkage, "", gen.module);
+    gen.builder.SetInsertPoint(llvm::BasicBlock::Create(gen.ctx, "entry", Scratch));
+    gen.symbTable = gen.globalSymbols;
+    llvm::Value * folded = m_expr->codegen(gen);
+    bool real = folded && folded->getType()->isDoubleTy();
+    auto * value = llvm::dyn_cast_or_null<llvm::ConstantInt>(folded);
+    Scratch->eraseFromParent();
+    gen.builder.ClearInsertionPoint();
+    // Interfaces carry integer constants only
+    if (real) {
+        throw std::runtime_error("Unit constant is not an integer: " + m_var);
+    }
+    if (!value) {
+        throw std::runtime_error("Unit constant is not a constant expression: " + m_var);
+    }
+
+    gen.globalSymbols[m_var] = {nullptr, true, value};
+    return static_cast<int>(value->getSExtValue());
+}
+
 //    llvm::Value* codegen(GenContext& gen) const override;
 
 BinaryExprAST::BinaryExprAST(char Op, std::unique_ptr<ExprAST> LHS, std::unique_ptr<ExprAST> RHS)
@@ -139,12 +279,45 @@ void BinaryExprAST::print(std::ostream &out, int indent) const {
     m_RHS->print(out, indent + 2);
     out << "\n" << std::string(indent, ' ') << "}";
 }
+static bool isComparison(char Op) {
+    return Op == '<' || Op == '>' || Op == tok_lessequal || Op == tok_greaterequal
+        || Op == tok_equal || Op == tok_notequal;
+}
+
 llvm::Value * BinaryExprAST::codegen(GenContext& gen)  {
+    // Assignment evaluates its operands itself, exactly once
+    if (Op == tok_assign)
+        return codegenAssignment(gen);
+
+    // Truth values are computed as i1 and only widened when used as an integer
+    if (isBoolean()) {
+        llvm::Value *Cond = codegenCondition(gen);
+        return gen.builder.CreateZExt(Cond, llvm::Type::getInt32Ty(gen.ctx), "booltmp");
+    }
+
     llvm::Value *L = m_LHS->codegen(gen);
     llvm::Value *R = m_RHS->codegen(gen);
     if (!L || !R)
         return nullptr;
 
+    // A real operand makes the operation real, / always divides reals
+    if (L->getType()->isDoubleTy() || R->getType()->isDoubleTy() || Op == '/') {
+        L = promoteToReal(gen, L);
+        R = promoteToReal(gen, R);
+        switch (Op) {
+            case '+':
+                return gen.builder.CreateFAdd(L, R, "addtmp");
+            case '-':
+                return gen.builder.CreateFSub(L, R, "subtmp");
+            case '*':
+                return gen.builder.CreateFMul(L, R, "multmp");
+            case '/':
+                return gen.builder.CreateFDiv(L, R, "divtmp");
+            default:
+                throw std::runtime_error("Real operands are only allowed with +, -, *, / and comparisons");
+        }
+    }
+
     switch (Op) {
         case '+':
             return gen.builder.CreateAdd(L, R, "addtmp");
@@ -152,43 +325,14 @@ llvm::Value * BinaryExprAST::codegen(GenContext& gen)  {
             return gen.builder.CreateSub(L, R, "subtmp");
         case '*':
             return gen.builder.CreateMul(L, R, "multmp");
-        case '<':
-            L = gen.builder.CreateICmpSLT(L, R, "cmptmp");
-            // Convert bool 0/1 to int 0 or 1
-            return gen.builder.CreateIntCast(L, llvm::Type::getInt32Ty(gen.ctx), false, "lesstmp");
-        case '>':
-            L = gen.builder.CreateICmpSGT(L, R, "cmptmp");
-            // Convert bool 0/1 to int 0 or 1
-            return gen.builder.CreateIntCast(L, llvm::Type::getInt32Ty(gen.ctx), false, "greatertmp");
-        case tok_lessequal:
-            L = gen.builder.CreateICmpSLE(L, R, "cmptmp");
-            // Convert bool 0/1 to int 0 or 1
-            return gen.builder.CreateIntCast(L, llvm::Type::getInt32Ty(gen.ctx), false, "lsetmp");
-        case tok_greaterequal:
-            L = gen.builder.CreateICmpSGE(L, R, "cmptmp");
-            // Convert bool 0/1 to int 0 or 1
-            return gen.builder.CreateIntCast(L, llvm::Type::getInt32Ty(gen.ctx), false, "gsetmp");
-        case tok_equal:
-            L = gen.builder.CreateICmpEQ(L, R, "cmptmp");
-            // Convert bool 0/1 to int 0 or 1
-            return gen.builder.CreateIntCast(L, llvm::Type::getInt32Ty(gen.ctx), false, "eqtmp");
-        case tok_notequal:
-            L = gen.builder.CreateICmpNE(L, R, "cmptmp");
-            // Convert bool 0/1 to int 0 or 1
-            return gen.builder.CreateIntCast(L, llvm::Type::getInt32Ty(gen.ctx), false, "netmp");
+        // On integers and/or are bitwise, like in Pascal
         case tok_or:
-            L = gen.builder.CreateOr(L, R, "ortmp");
-            // Convert bool 0/1 to int 0 or 1
-            return gen.builder.CreateIntCast(L, llvm::Type::getInt32Ty(gen.ctx), false, "ortmp");
+            return gen.builder.CreateOr(L, R, "ortmp");
         case tok_and:
-            L = gen.builder.CreateAnd(L, R, "andtmp");
-            // Convert bool 0/1 to int 0 or 1
-            return gen.builder.CreateIntCast(L, llvm::Type::getInt32Ty(gen.ctx), false, "andtmp");
+            return gen.builder.CreateAnd(L, R, "andtmp");
 
         case tok_mod:
             return gen.builder.CreateSRem(L, R, "sremtmp");
-        case tok_assign:
-            return codegenAssignment(gen);
 
 
 //            case tok_and:
@@ -199,30 +343,130 @@ llvm::Value * BinaryExprAST::codegen(GenContext& gen)  {
     };
 }
 
-llvm::Value * BinaryExprAST::codegenAssignment(GenContext & gen) {
-    // Generate code for the LHS, which should be an address
-    llvm::Value* lhs = m_LHS->codegen(gen);
-    if (!lhs) {
-        throw std::runtime_error("Failed to generate LHS for assignment.");
+bool BinaryExprAST::isBoolean() const {
+    if (isComparison(Op))
+        return true;
+    if (Op == tok_and || Op == tok_or)
+        return m_LHS->isBoolean() && m_RHS->isBoolean();
+    return false;
+}
+
+llvm::Value * BinaryExprAST::codegenCondition(GenContext& gen) {
+    if (Op == tok_and || Op == tok_or) {
+        if (!isBoolean())
+            return ExprAST::codegenCondition(gen);
+
+        // Short circuit: the RHS is only evaluated when the LHS does not decide the result
+        llvm::Function *TheFunction = gen.builder.GetInsertBlock()->getParent();
+        llvm::BasicBlock *RHSBB = llvm::BasicBlock::Create(gen.ctx, Op == tok_and ? "andrhs" : "orrhs");
+        llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(gen.ctx, Op == tok_and ? "andcont" : "orcont");
+
+        llvm::Value *L = m_LHS->codegenCondition(gen);
+        llvm::BasicBlock *LHSEndBB = gen.builder.GetInsertBlock();
+        if (Op == tok_and)
+            gen.builder.CreateCondBr(L, RHSBB, MergeBB);
+        else
+            gen.builder.CreateCondBr(L, MergeBB, RHSBB);
+
+        TheFunction->getBasicBlockList().push_back(RHSBB);
+        gen.builder.SetInsertPoint(RHSBB);
+        llvm::Value *R = m_RHS->codegenCondition(gen);
+        llvm::BasicBlock *RHSEndBB = gen.builder.GetInsertBlock();
+        gen.builder.CreateBr(MergeBB);
+
+        TheFunction->getBasicBlockList().push_back(MergeBB);
+        gen.builder.SetInsertPoint(MergeBB);
+        llvm::PHINode *Result = gen.builder.CreatePHI(llvm::Type::getInt1Ty(gen.ctx), 2, Op == tok_and ? "andtmp" : "ortmp");
+        Result->addIncoming(llvm::ConstantInt::getBool(gen.ctx, Op == tok_or), LHSEndBB);
+        Result->addIncoming(R, RHSEndBB);
+        return Result;
     }
-    auto searchIter = gen.symbTable.find(m_LHS->getName());
-    if(searchIter != gen.symbTable.end()) {
-        if(searchIter->second.constant) {
-            throw std::runtime_error("Trying to change const value");
+
+    if (!isComparison(Op))
+        return ExprAST::codegenCondition(gen);
+
+    llvm::Value *L = m_LHS->codegen(gen);
+    llvm::Value *R = m_RHS->codegen(gen);
+    if (!L || !R)
+        return nullptr;
+
+    // Ordered comparisons are false for NaN, <> is true for it
+    if (L->getType()->isDoubleTy() || R->getType()->isDoubleTy()) {
+        L = promoteToReal(gen, L);
+        R = promoteToReal(gen, R);
+        switch (Op) {
+            case '<':
+                return gen.builder.CreateFCmpOLT(L, R, "lesstmp");
+            case '>':
+                return gen.builder.CreateFCmpOGT(L, R, "greatertmp");
+            case tok_lessequal:
+                return gen.builder.CreateFCmpOLE(L, R, "lsetmp");
+            case tok_greaterequal:
+                return gen.builder.CreateFCmpOGE(L, R, "gsetmp");
+            case tok_equal:
+                return gen.builder.CreateFCmpOEQ(L, R, "eqtmp");
+            default:
+                return gen.builder.CreateFCmpUNE(L, R, "netmp");
         }
     }
 
+    switch (Op) {
+        case '<':
+            return gen.builder.CreateICmpSLT(L, R, "lesstmp");
+        case '>':
+            return gen.builder.CreateICmpSGT(L, R, "greatertmp");
+        case tok_lessequal:
+            return gen.builder.CreateICmpSLE(L, R, "lsetmp");
+        case tok_greaterequal:
+            return gen.builder.CreateICmpSGE(L, R, "gsetmp");
+        case tok_equal:
+            return gen.builder.CreateICmpEQ(L, R, "eqtmp");
+        default:
+            return gen.builder.CreateICmpNE(L, R, "netmp");
+    }
+}
+
+void BinaryExprAST::codegenBranch(GenContext& gen, llvm::BasicBlock *TrueBB, llvm::BasicBlock *FalseBB) {
+    if ((Op != tok_and && Op != tok_or) || !isBoolean()) {
+        ExprAST::codegenBranch(gen, TrueBB, FalseBB);
+        return;
+    }
+
+    // Short circuit straight into the targets, no truth value is materialised
+    llvm::Function *TheFunction = gen.builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock *RHSBB = llvm::BasicBlock::Create(gen.ctx, Op == tok_and ? "andrhs" : "orrhs");
+    if (Op == tok_and)
+        m_LHS->codegenBranch(gen, RHSBB, FalseBB);
+    else
+        m_LHS->codegenBranch(gen, TrueBB, RHSBB);
+
+    TheFunction->getBasicBlockList().push_back(RHSBB);
+    gen.builder.SetInsertPoint(RHSBB);
+    m_RHS->codegenBranch(gen, TrueBB, FalseBB);
+}
+
+llvm::Value * BinaryExprAST::codegenAssignment(GenContext & gen) {
+    // The LHS must name a variable, it is written to and never read
+    auto searchIter = gen.symbTable.find(m_LHS->getName());
+    if(searchIter == gen.symbTable.end()) {
+        throw std::runtime_error("Failed to generate LHS for assignment: " + m_LHS->getName());
+    }
+    if(searchIter->second.constant) {
+        throw std::runtime_error("Trying to change const value");
+    }
+
     // Generate code for the RHS, which should be a value
     llvm::Value* rhs = m_RHS->codegen(gen);
     if (!rhs) {
         throw std::runtime_error("Failed to generate RHS for assignment.");
     }
 
-    llvm::Value * variable = gen.symbTable[m_LHS->getName()].store;
+    llvm::AllocaInst * variable = gen.symbTable[m_LHS->getName()].store;
     if(!variable) {
         std::clog << "Var name(from LLVM): " << m_LHS->getName() << std::endl;
         throw std::runtime_error("Unknown variable");
     }
+    rhs = convertValue(gen, rhs, variable->getAllocatedType(), m_LHS->getName());
 
     // Store the RHS value into the LHS address
     gen.builder.CreateStore(rhs, variable);
@@ -231,6 +475,73 @@ llvm::Value * BinaryExprAST::codegenAssignment(GenContext & gen) {
     return rhs;
 }
 
+void BinaryExprAST::markTailCalls(const PrototypeAST &proto, bool tail) {
+    // FName := call(...) in tail position returns the call's result
+    if (!tail || Op != tok_assign || proto.isProcedure() || m_LHS->getName() != proto.getName())
+        return;
+    if (auto * call = dynamic_cast<CallExprAST *>(m_RHS.get()))
+        call->setTailCall();
+}
+void BinaryExprAST::collectCallees(std::set<std::string> &callees) const {
+    m_LHS->collectCallees(callees);
+    m_RHS->collectCallees(callees);
+}
+void BinaryExprAST::forEachChild(const std::function<void(const AST &)> &visit) const {
+    visit(*m_LHS);
+    visit(*m_RHS);
+}
+
+
+UnaryExprAST::UnaryExprAST(char Op, std::unique_ptr<ExprAST> Operand)
+        : Op(Op), m_Operand(std::move(Operand)) {}
+const std::string & UnaryExprAST::getName() const {
+    static const std::string name;
+    return name;
+}
+
+void UnaryExprAST::print(std::ostream &out, int indent) const {
+    out << std::string(indent, ' ') << "{\n";
+    out << std::string(indent + 2, ' ') << "\"type\": \"UnaryExprAST\",\n";
+    out << std::string(indent + 2, ' ') << "\"operator\": \"not\",\n";
+    out << std::string(indent + 2, ' ') << "\"operand\": ";
+    m_Operand->print(out, indent + 2);
+    out << "\n" << std::string(indent, ' ') << "}";
+}
+void UnaryExprAST::collectCallees(std::set<std::string> &callees) const {
+    m_Operand->collectCallees(callees);
+}
+void UnaryExprAST::forEachChild(const std::function<void(const AST &)> &visit) const {
+    visit(*m_Operand);
+}
+llvm::Value * UnaryExprAST::codegen(GenContext& gen) {
+    if (isBoolean()) {
+        llvm::Value *Cond = codegenCondition(gen);
+        return gen.builder.CreateZExt(Cond, llvm::Type::getInt32Ty(gen.ctx), "booltmp");
+    }
+    // On integers not is bitwise, like in Pascal
+    llvm::Value *V = m_Operand->codegen(gen);
+    if (!V)
+        return nullptr;
+    if (V->getType()->isDoubleTy())
+        throw std::runtime_error("not needs an integer or truth value operand");
+    return gen.builder.CreateNot(V, "nottmp");
+}
+bool UnaryExprAST::isBoolean() const {
+    return m_Operand->isBoolean();
+}
+llvm::Value * UnaryExprAST::codegenCondition(GenContext& gen) {
+    if (!isBoolean())
+        return ExprAST::codegenCondition(gen);
+    return gen.builder.CreateNot(m_Operand->codegenCondition(gen), "nottmp");
+}
+void UnaryExprAST::codegenBranch(GenContext& gen, llvm::BasicBlock *TrueBB, llvm::BasicBlock *FalseBB) {
+    if (!isBoolean()) {
+        ExprAST::codegenBranch(gen, TrueBB, FalseBB);
+        return;
+    }
+    m_Operand->codegenBranch(gen, FalseBB, TrueBB);
+}
+
 
 CallExprAST::CallExprAST(std::string Callee, std::vector<std::unique_ptr<ExprAST>> Args)
         : Callee(std::move(Callee)), Args(std::move(Args)) {}
@@ -251,13 +562,31 @@ void CallExprAST::print(std::ostream &out, int indent) const {
 llvm::Value * CallExprAST::PredefinedFunctions(GenContext& gen) {
     if(Callee == "dec") {
         if(Args.empty()) return nullptr;
-        llvm::AllocaInst * Var = gen.symbTable.find(Args[0]->getName())->second.store;
-        llvm::Value * Val = gen.builder.CreateLoad(llvm::Type::getInt32Ty(gen.ctx), Var, Args[0]->getName());
-        llvm::Value * Add = gen.builder.CreateSub(Val, NumberExprAST(1).codegen(gen));
+        llvm::AllocaInst * Var = writableStore(gen, Args[0]->getName());
+        llvm::Type * Type = Var->getAllocatedType();
+        llvm::Value * Val = gen.builder.CreateLoad(Type, Var, Args[0]->getName());
+        llvm::Value * Add = Type->isDoubleTy() ? gen.builder.CreateFSub(Val, llvm::ConstantFP::get(Type, 1.0))
+                                               : gen.builder.CreateSub(Val, NumberExprAST(1).codegen(gen));
         gen.builder.CreateStore(Add, Var);
-        gen.symbTable[Args[0]->getName()] = {Var, false};
         return Add;
     }
+    // Real to integer, towards zero or to the nearest integer (halves away from zero), unless the program has its own
+    if ((Callee == "trunc" || Callee == "round") && Args.size() == 1 && !gen.module.getFunction(Callee)) {
+        llvm::Value * V = Args[0]->codegen(gen);
+        if (!V)
+            throw std::runtime_error("Argument of " + Callee + " has no value");
+        V = promoteToReal(gen, V);
+        llvm::Value * Truncated = gen.builder.CreateFPToSI(V, llvm::Type::getInt32Ty(gen.ctx), "trunctmp");
+        if (Callee == "trunc")
+            return Truncated;
+        // llvm.round would be a libm call, the fraction left by truncation is exact for every value that fits
+        llvm::Value * Fraction = gen.builder.CreateFSub(V, promoteToReal(gen, Truncated), "fractmp");
+        llvm::Value * Half = llvm::ConstantFP::get(V->getType(), 0.5);
+        llvm::Value * Up = gen.builder.CreateZExt(gen.builder.CreateFCmpOGE(Fraction, Half), Truncated->getType());
+        llvm::Value * Down = gen.builder.CreateZExt(gen.builder.CreateFCmpOLE(Fraction, gen.builder.CreateFNeg(Half)),
+                                                    Truncated->getType());
+        return gen.builder.CreateSub(gen.builder.CreateAdd(Truncated, Up), Down, "roundtmp");
+    }
     return nullptr;
 }
 llvm::Value * CallExprAST::codegen(GenContext& gen)  {
@@ -289,18 +618,27 @@ llvm::Value * CallExprAST::codegen(GenContext& gen)  {
         // Special case for "readln" function
         if (Callee == "readln") {
             // Create a pointer to the argument if necessary
-            llvm::AllocaInst * var = gen.symbTable[Args[i]->getName()].store;
-            if(!var) {
-                throw std::runtime_error("Var doesn't exist");
-            }
+            llvm::AllocaInst * var = writableStore(gen, Args[i]->getName());
+            if (var->getAllocatedType()->isDoubleTy())
+                calleeF = gen.module.getFunction("readln_real");
             //                Args[i].
             argsV.push_back(var);
         } else {
-            argsV.push_back(argValue);
+            if (!argValue)
+                throw std::runtime_error("Argument of " + Callee + " has no value");
+            // write and writeln have variants of their own for reals
+            if ((Callee == "write" || Callee == "writeln") && argValue->getType()->isDoubleTy())
+                calleeF = gen.module.getFunction(Callee + "_real");
+            argsV.push_back(convertValue(gen, argValue, calleeF->getFunctionType()->getParamType(i), Callee));
         }
 
     }
 
+    // readln gets pointers to the caller's variables, so it can never be a tail call
+    if (m_TailCall && Callee != "readln") {
+        return codegenTailCall(gen, calleeF, argsV);
+    }
+
     // Check if the callee function returns void
     if (calleeF->getReturnType()->isVoidTy()) {
         gen.builder.CreateCall(calleeF, argsV);
@@ -311,29 +649,95 @@ llvm::Value * CallExprAST::codegen(GenContext& gen)  {
     }
 };
 
-PrototypeAST::PrototypeAST(const std::string &Name, std::vector<std::string> Args, std::unique_ptr<VarDeclAST> Return)
-        : m_Name(Name), m_Args(std::move(Args)), m_Return(std::move(Return)) {}
+llvm::Value * CallExprAST::codegenTailCall(GenContext& gen, llvm::Function * calleeF, const std::vector<llvm::Value *> & argsV) {
+    llvm::Function * TheFunction = gen.builder.GetInsertBlock()->getParent();
+    llvm::Type * ReturnType = TheFunction->getReturnType();
+    if (calleeF->getReturnType() != ReturnType) {
+        return gen.builder.CreateCall(calleeF, argsV);
+    }
+
+    llvm::Value * result = nullptr;
+    if (calleeF == TheFunction && gen.tailRecurseBlock) {
+        // Self recursion becomes a loop: rebind the parameters and jump back to the top of the body
+        unsigned Idx = 0;
+        for (auto &Arg : TheFunction->args())
+            gen.builder.CreateStore(argsV[Idx++], gen.symbTable[std::string(Arg.getName())].store);
+        gen.builder.CreateBr(gen.tailRecurseBlock);
+        if (!ReturnType->isVoidTy())
+            result = llvm::UndefValue::get(ReturnType);
+    } else {
+        llvm::CallInst * call = gen.builder.CreateCall(calleeF, argsV);
+        // musttail is only legal between identical signatures, otherwise leave the backend a hint
+        call->setTailCallKind(calleeF->getFunctionType() == TheFunction->getFunctionType()
+                              ? llvm::CallInst::TCK_MustTail : llvm::CallInst::TCK_Tail);
+        if (ReturnType->isVoidTy()) {
+            gen.builder.CreateRetVoid();
+        } else {
+            gen.builder.CreateRet(call);
+            result = call;
+        }
+    }
+
+    // Whatever follows the tail call is unreachable
+    gen.builder.SetInsertPoint(llvm::BasicBlock::Create(gen.ctx, "aftertail", TheFunction));
+    return result;
+}
+
+void CallExprAST::markTailCalls(const PrototypeAST &proto, bool tail) {
+    // A bare call statement is only returned from when the routine returns nothing
+    if (tail && proto.isProcedure())
+        m_TailCall = true;
+}
+void CallExprAST::collectCallees(std::set<std::string> &callees) const {
+    callees.insert(Callee);
+    for (const auto &arg : Args)
+        arg->collectCallees(callees);
+}
+void CallExprAST::forEachChild(const std::function<void(const AST &)> &visit) const {
+    for (const auto &arg : Args)
+        visit(*arg);
+}
+
+PrototypeAST::PrototypeAST(const std::string &Name, std::vector<std::string> Args, std::unique_ptr<VarDeclAST> Return,
+                           std::vector<TypeAST::Type> ArgTypes)
+        : m_Name(Name), m_Args(std::move(Args)), m_Return(std::move(Return)), m_ArgTypes(std::move(ArgTypes)) {
+    m_ArgTypes.resize(m_Args.size(), TypeAST::Type::INT);
+}
 
 const std::string & PrototypeAST::getName() const { return m_Name; }
 
+void PrototypeAST::forEachChild(const std::function<void(const AST &)> &visit) const {
+    if (m_Return)
+        visit(*m_Return);
+}
+
 void PrototypeAST::print(std::ostream &out, int indent ) const {
     out << std::string(indent, ' ') << "{\n";
     out << std::string(indent + 2, ' ') << "\"type\": \"PrototypeAST\",\n";
     out << std::string(indent + 2, ' ') << "\"name\": \"" << m_Name << "\",\n";
+    out << std::string(indent + 2, ' ') << "\"procedure\": " << (isProcedure() ? "true" : "false") << ",\n";
     out << std::string(indent + 2, ' ') << "\"args\": [\n";
-    for (const auto &arg : m_Args) {
-        out << std::string(indent + 4, ' ') << "\"" << arg << "\",\n";
+    for (size_t i = 0; i < m_Args.size(); i++) {
+        out << std::string(indent + 4, ' ') << "\"" << m_Args[i] << (m_ArgTypes[i] == TypeAST::Type::DOUBLE ? ": real" : "")
+            << "\",\n";
     }
-    out << std::string(indent + 2, ' ') << "]\n";
+    out << std::string(indent + 2, ' ') << "]";
+    if (m_Return && m_Return->getType() == TypeAST::Type::DOUBLE)
+        out << ",\n" << std::string(indent + 2, ' ') << "\"result\": \"real\"";
+    out << "\n";
     out << std::string(indent, ' ') << "}";
 }
 llvm::Function * PrototypeAST::codegen(GenContext& gen)  {
-    std::vector<llvm::Type *> INTS(m_Args.size(), llvm::Type::getInt32Ty(gen.ctx));
+    std::vector<llvm::Type *> ArgTypes;
+    for (TypeAST::Type type : m_ArgTypes)
+        ArgTypes.push_back(TypeAST::getLLVMType(gen.ctx, type));
     llvm::FunctionType * FT = nullptr;
     if(m_Return == nullptr && m_Name != "main")
-        FT = llvm::FunctionType::get(llvm::Type::getVoidTy(gen.ctx), INTS ,false);
+        FT = llvm::FunctionType::get(llvm::Type::getVoidTy(gen.ctx), ArgTypes ,false);
+    else if (m_Return)
+        FT = llvm::FunctionType::get(TypeAST::getLLVMType(gen.ctx, m_Return->getType()), ArgTypes ,false);
     else
-        FT = llvm::FunctionType::get(llvm::Type::getInt32Ty(gen.ctx), INTS ,false);
+        FT = llvm::FunctionType::get(llvm::Type::getInt32Ty(gen.ctx), ArgTypes ,false);
     llvm::Function *F =
             llvm::Function::Create(FT, llvm::Function::ExternalLinkage, m_Name, gen.module);
 
@@ -346,7 +750,10 @@ llvm::Function * PrototypeAST::codegen(GenContext& gen)  {
 };
 
 FunctionAST::FunctionAST(std::unique_ptr<PrototypeAST> Proto, std::vector<std::unique_ptr<VarDeclAST>> Vars, std::unique_ptr<AST> Body)
-        : m_Proto(std::move(Proto)), m_Vars(std::move(Vars)), m_Body(std::move(Body)) {}
+        : m_Proto(std::move(Proto)), m_Vars(std::move(Vars)), m_Body(std::move(Body)) {
+    if (m_Body)
+        m_Body->markTailCalls(*m_Proto, true);
+}
 
 void FunctionAST::print(std::ostream &out, int indent) const {
     out << std::string(indent, ' ') << "{\n";
@@ -354,20 +761,52 @@ void FunctionAST::print(std::ostream &out, int indent) const {
     out << std::string(indent + 2, ' ') << "\"prototype\": ";
     m_Proto->print(out, indent + 2);
     out << ",\n";
+    out << std::string(indent + 2, ' ') << "\"vars\": [\n";
+    for (const auto &var : m_Vars) {
+        var->print(out, indent + 4);
+        out << ",\n";
+    }
+    out << std::string(indent + 2, ' ') << "],\n";
     out << std::string(indent + 2, ' ') << "\"body\": ";
     if(m_Body)
         m_Body->print(out, indent + 2);
     out << "\n" << std::string(indent, ' ') << "}";
 }
+void FunctionAST::collectCallees(std::set<std::string> &callees) const {
+    for (const auto &var : m_Vars)
+        var->collectCallees(callees);
+    if (m_Body)
+        m_Body->collectCallees(callees);
+}
+void FunctionAST::forEachChild(const std::function<void(const AST &)> &visit) const {
+    visit(*m_Proto);
+    for (const auto &var : m_Vars)
+        visit(*var);
+    if (m_Body)
+        visit(*m_Body);
+}
 llvm::Value * FunctionAST::codegen(GenContext& gen)  {
     llvm::Function *TheFunction = gen.module.getFunction(m_Proto->getName());
     if (!TheFunction)
         TheFunction = m_Proto->codegen(gen);
     if(!m_Body) return TheFunction;
+    // --fast-math: the floating-point operations of the routine may be reassociated, contracted and vectorised
+    llvm::FastMathFlags FMF;
+    if (gen.fastMath)
+        FMF.setFast();
+    gen.builder.setFastMathFlags(FMF);
     if(m_Proto->getName() == "main") {
         llvm::BasicBlock *MainBB = llvm::BasicBlock::Create(gen.ctx, "entry", TheFunction);
         gen.builder.SetInsertPoint(MainBB);
-        gen.symbTable.clear();
+        gen.symbTable = gen.globalSymbols;
+        gen.tailRecurseBlock = nullptr;
+        if (gen.debugInfo)
+            gen.debugInfo->beginFunction(gen.builder, *TheFunction, getPosition());
+        llvm::Value *region = nullptr;
+        if (gen.sourceProfile) {
+            region = createProfileRegion(gen, "main", getPosition());
+            profileEnter(gen, region);
+        }
 
         for (auto &variable : m_Vars)
         {
@@ -377,16 +816,26 @@ llvm::Value * FunctionAST::codegen(GenContext& gen)  {
         m_Body->codegen(gen);
         // return 0
         gen.builder.CreateRet(llvm::ConstantInt::get(llvm::Type::getInt32Ty(gen.ctx), 0));
+        if (region)
+            profileReturns(*TheFunction, region);
+        if (gen.debugInfo)
+            gen.debugInfo->endFunction(gen.builder);
         return TheFunction;
     }
 
     llvm::BasicBlock * BB = llvm::BasicBlock::Create(gen.ctx, m_Proto->getName(), TheFunction);
     gen.builder.SetInsertPoint(BB);
+    if (gen.debugInfo)
+        gen.debugInfo->beginFunction(gen.builder, *TheFunction, getPosition());
 
-    gen.symbTable.clear();
+    gen.symbTable = gen.globalSymbols;
     // Create return value
-    llvm::AllocaInst *AllocaReturnVar = gen.builder.CreateAlloca(llvm::Type::getInt32Ty(gen.ctx), nullptr, m_Proto->getName());
+    llvm::Type *ReturnType = TheFunction->getReturnType();
+    llvm::AllocaInst *AllocaReturnVar = gen.builder.CreateAlloca(ReturnType->isVoidTy() ? llvm::Type::getInt32Ty(gen.ctx) : ReturnType,
+                                                                 nullptr, m_Proto->getName());
     gen.symbTable[std::string(m_Proto->getName())] = {AllocaReturnVar, false};
+    if (gen.debugInfo && !TheFunction->getReturnType()->isVoidTy())
+        gen.debugInfo->declareVariable(gen.builder, AllocaReturnVar, m_Proto->getName(), getPosition());
 
     for (auto &Arg : TheFunction->args()) {
         // Create an alloca for this variable
@@ -395,12 +844,25 @@ llvm::Value * FunctionAST::codegen(GenContext& gen)  {
         gen.builder.CreateStore(&Arg, Alloca);
         // Add the variable to the symbol table
         gen.symbTable[std::string(Arg.getName())] = {Alloca, false};
+        if (gen.debugInfo)
+            gen.debugInfo->declareVariable(gen.builder, Alloca, Arg.getName().str(), getPosition(), Arg.getArgNo() + 1);
     }
 
     for(auto &Var : m_Vars)
         Var->codegen(gen);
 
+    // Self tail calls become iterations of the body, not calls of the region
+    llvm::Value *region = nullptr;
+    if (gen.sourceProfile) {
+        region = createProfileRegion(gen, m_Proto->getName(), getPosition());
+        profileEnter(gen, region);
+    }
 
+    // Self tail calls re-enter here instead of growing the stack
+    llvm::BasicBlock * BodyBB = llvm::BasicBlock::Create(gen.ctx, "tailrecurse", TheFunction);
+    gen.builder.CreateBr(BodyBB);
+    gen.builder.SetInsertPoint(BodyBB);
+    gen.tailRecurseBlock = BodyBB;
 
     m_Body->codegen(gen);
 
@@ -408,11 +870,16 @@ llvm::Value * FunctionAST::codegen(GenContext& gen)  {
     if (TheFunction->getReturnType()->isVoidTy()) {
         gen.builder.CreateRetVoid();
     } else {
-        llvm::Value *RetVal = gen.builder.CreateLoad(llvm::Type::getInt32Ty(gen.ctx), AllocaReturnVar, "return");
+        llvm::Value *RetVal = gen.builder.CreateLoad(ReturnType, AllocaReturnVar, "return");
         gen.builder.CreateRet(RetVal);
     }
+    if (region)
+        profileReturns(*TheFunction, region);
+    if (gen.debugInfo)
+        gen.debugInfo->endFunction(gen.builder);
 
     // Validate the generated code, checking for consistency
+    TimeReport::Scope scope(gen.timeReport, "verify");
     llvm::verifyFunction(*TheFunction);
 
     return TheFunction;
@@ -423,6 +890,8 @@ void FunctionExitAST::print(std::ostream &out, int indent ) const {
     out << std::string(indent + 2, ' ') << "\"type\": \">Function Exit<\",\n";
 }
 llvm::Value * FunctionExitAST::codegen(GenContext& gen) {
+    if (gen.parallelBody)
+        throw std::runtime_error("'exit' used in the body of a parallel for");
     llvm::Function *TheFunction = gen.builder.GetInsertBlock()->getParent();
     llvm::Type *ReturnType = TheFunction->getReturnType();
     std::string functionName = TheFunction->getName().str();
@@ -430,27 +899,32 @@ llvm::Value * FunctionExitAST::codegen(GenContext& gen) {
     if (ReturnType->isVoidTy()) {
     gen.builder.CreateRetVoid();
     } else {
-    llvm::Value *RetVal = gen.builder.CreateLoad(llvm::Type::getInt32Ty(gen.ctx),
+    llvm::Value *RetVal = gen.builder.CreateLoad(ReturnType,
                                                  gen.symbTable[std::string(functionName)].store, functionName);
     gen.builder.CreateRet(RetVal);
     }
+    // Statements after exit are unreachable, keep emitting them into a block of their own
+    gen.builder.SetInsertPoint(llvm::BasicBlock::Create(gen.ctx, "afterexit", TheFunction));
     return nullptr;
 };
 
 void LoopBreakAST::print(std::ostream &out, int indent) const {
-    out << std::string(indent + 2, ' ') << "\"type\": \">Function Exit<\",\n";
+    out << std::string(indent + 2, ' ') << "\"type\": \">Loop Break<\",\n";
 }
 llvm::Value * LoopBreakAST::codegen(GenContext& gen) {
-    if (gen.loopExitBlocks.empty()) {
-    std::cerr << "Error: 'break' used outside of loop" << std::endl;
-    return nullptr;
-    }
+    if (gen.loopExitBlocks.empty() && gen.parallelBody)
+        throw std::runtime_error("'break' cannot leave a parallel for");
+    if (gen.loopExitBlocks.empty())
+        throw std::runtime_error("'break' used outside of loop");
     llvm::BasicBlock *ExitBB = gen.loopExitBlocks.top();
+    llvm::Function *TheFunction = gen.builder.GetInsertBlock()->getParent();
     gen.builder.CreateBr(ExitBB);
+    // Statements after break are unreachable, keep emitting them into a block of their own
+    gen.builder.SetInsertPoint(llvm::BasicBlock::Create(gen.ctx, "afterbreak", TheFunction));
     return nullptr;
 };
 
-IfStmtAST::IfStmtAST(std::unique_ptr<AST> cond, std::unique_ptr<AST> then,
+IfStmtAST::IfStmtAST(std::unique_ptr<ExprAST> cond, std::unique_ptr<AST> then,
           std::unique_ptr<AST> Else)
         : m_Cond(std::move(cond)), m_Then(std::move(then)), m_Else(std::move(Else)) {}
 
@@ -466,38 +940,31 @@ void IfStmtAST::print(std::ostream &out, int indent) const {
 }
 
 llvm::Value * IfStmtAST::codegen(GenContext & gen) {
-    llvm::Value *CondV = m_Cond->codegen(gen);
-    if (!CondV)
-        return nullptr;
-
-    // Convert condition to a bool by comparing non-equal to 0
-    CondV = gen.builder.CreateICmpNE(CondV, llvm::ConstantInt::get(CondV->getType(), 0, true), "ifcond");
-
-
     llvm::Function * TheFunction = gen.builder.GetInsertBlock()->getParent();
 
     // Create blocks for the then, else, and the continuation (merge) block
-    llvm::BasicBlock *ThenBB = llvm::BasicBlock::Create(gen.ctx, "then", TheFunction);
+    llvm::BasicBlock *ThenBB = llvm::BasicBlock::Create(gen.ctx, "then");
     llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(gen.ctx, "ifcont");
+    llvm::BasicBlock *ElseBB = m_Else ? llvm::BasicBlock::Create(gen.ctx, "else") : nullptr;
 
-    llvm::BasicBlock *ElseBB = nullptr;
-    if (m_Else) {
-        ElseBB = llvm::BasicBlock::Create(gen.ctx, "else");
-        gen.builder.CreateCondBr(CondV, ThenBB, ElseBB);
-    } else {
-        gen.builder.CreateCondBr(CondV, ThenBB, MergeBB);
-    }
+    // Branch on the condition directly, and/or short circuit on the way
+    m_Cond->codegenBranch(gen, ThenBB, m_Else ? ElseBB : MergeBB);
 
+    TheFunction->getBasicBlockList().push_back(ThenBB);
     gen.builder.SetInsertPoint(ThenBB);
 
+    emitLocation(gen, *m_Then);
     m_Then->codegen(gen);
 
+    emitLocation(gen, *this);
     gen.builder.CreateBr(MergeBB);
 
     if(m_Else) {
         TheFunction->getBasicBlockList().push_back(ElseBB);
         gen.builder.SetInsertPoint(ElseBB);
+        emitLocation(gen, *m_Else);
         m_Else->codegen(gen);
+        emitLocation(gen, *this);
         gen.builder.CreateBr(MergeBB);
     }
 
@@ -507,6 +974,77 @@ llvm::Value * IfStmtAST::codegen(GenContext & gen) {
     return MergeBB;
 }
 
+void IfStmtAST::markTailCalls(const PrototypeAST &proto, bool tail) {
+    m_Then->markTailCalls(proto, tail);
+    if (m_Else)
+        m_Else->markTailCalls(proto, tail);
+}
+void IfStmtAST::collectCallees(std::set<std::string> &callees) const {
+    m_Cond->collectCallees(callees);
+    m_Then->collectCallees(callees);
+    if (m_Else)
+        m_Else->collectCallees(callees);
+}
+void IfStmtAST::forEachChild(const std::function<void(const AST &)> &visit) const {
+    visit(*m_Cond);
+    visit(*m_Then);
+    if (m_Else)
+        visit(*m_Else);
+}
+
+bool LoopDirectives::empty() const {
+    return !vectorize && !interleaveCount && !unroll;
+}
+
+std::string LoopDirectives::describe() const {
+    std::string text;
+    auto add = [&text](const std::string &directive) {
+        text += (text.empty() ? "{$" : " {$") + directive + "}";
+    };
+    if (vectorize)
+        add(*vectorize ? "vectorize" + (vectorizeWidth ? " width=" + std::to_string(vectorizeWidth) : "") : "novectorize");
+    if (interleaveCount)
+        add("interleave " + std::to_string(interleaveCount));
+    if (unroll)
+        add(*unroll ? "unroll" + (unrollCount ? " " + std::to_string(unrollCount) : "") : "nounroll");
+    return text;
+}
+
+// The loop properties of the LangRef (llvm.loop.*) for the latch branch of a loop, plus the line of the loop
+// (mila.loop.line) for the warnings about transformations that could not be done
+static void attachLoopMetadata(GenContext &gen, llvm::Instruction *latch, const LoopDirectives &directives,
+                               const Position &position) {
+    if (directives.empty())
+        return;
+    llvm::SmallVector<llvm::Metadata *, 8> properties = {nullptr};
+    auto property = [&](const char *name, llvm::Optional<unsigned> value = llvm::None, unsigned bits = 32) {
+        llvm::SmallVector<llvm::Metadata *, 2> operands = {llvm::MDString::get(gen.ctx, name)};
+        if (value)
+            operands.push_back(llvm::ConstantAsMetadata::get(
+                    llvm::ConstantInt::get(llvm::IntegerType::get(gen.ctx, bits), *value)));
+        properties.push_back(llvm::MDNode::get(gen.ctx, operands));
+    };
+    if (directives.vectorize)
+        property("llvm.loop.vectorize.enable", *directives.vectorize ? 1 : 0, 1);
+    if (directives.vectorizeWidth)
+        property("llvm.loop.vectorize.width", directives.vectorizeWidth);
+    if (directives.interleaveCount)
+        property("llvm.loop.interleave.count", directives.interleaveCount);
+    if (directives.unroll && !*directives.unroll)
+        property("llvm.loop.unroll.disable");
+    else if (directives.unroll && directives.unrollCount)
+        property("llvm.loop.unroll.count", directives.unrollCount);
+    else if (directives.unroll)
+        property("llvm.loop.unroll.full");
+    if (position.getLine())
+        property("mila.loop.line", position.getLine());
+
+    // A loop id refers to itself, so that no two loops share it
+    llvm::MDNode *loopId = llvm::MDNode::getDistinct(gen.ctx, properties);
+    loopId->replaceOperandWith(0, loopId);
+    latch->setMetadata(llvm::LLVMContext::MD_loop, loopId);
+}
+
 ForStmtAST::ForStmtAST(const std::string &Var, std::unique_ptr<ExprAST> Start,
            std::unique_ptr<ExprAST> End, std::unique_ptr<NumberExprAST> Step,
            std::unique_ptr<AST> Body)
@@ -516,6 +1054,17 @@ ForStmtAST::ForStmtAST(const std::string &Var, std::unique_ptr<ExprAST> Start,
     void ForStmtAST::print(std::ostream &out, int indent ) const  {
         out << std::string(indent, ' ') << "{\n";
         out << std::string(indent + 2, ' ') << "\"type\": \"FOR\",\n";
+        out << std::string(indent + 2, ' ') << "\"var\": \"" << m_Var << "\",\n";
+        if (!m_Directives.empty()) {
+            // The line goes into the loop metadata, incremental compilation must see it change
+            out << std::string(indent + 2, ' ') << "\"directives\": \"" << m_Directives.describe() << "\",\n";
+            out << std::string(indent + 2, ' ') << "\"line\": " << getPosition().getLine() << ",\n";
+        }
+        if (m_Parallel) {
+            out << std::string(indent + 2, ' ') << "\"parallel\": true,\n";
+            for (const LoopReduction &reduction : m_Reductions)
+                out << std::string(indent + 2, ' ') << "\"reduce\": \"" << reduction.var << ": " << reduction.op << "\",\n";
+        }
         m_Start->print(out, indent + 2);
         m_End->print(out, indent + 2);
         m_Step->print(out, indent + 2);
@@ -524,70 +1073,290 @@ ForStmtAST::ForStmtAST(const std::string &Var, std::unique_ptr<ExprAST> Start,
     }
 
     llvm::Value * ForStmtAST::codegen(GenContext & gen)  {
+        auto searchIt = gen.symbTable.find(m_Var);
+        if (searchIt == gen.symbTable.end()) {
+            throw std::runtime_error("Unknown loop variable: " + m_Var);
+        }
+        if (searchIt->second.store && !searchIt->second.store->getAllocatedType()->isIntegerTy()) {
+            throw std::runtime_error("Loop variable is not an integer: " + m_Var);
+        }
+
+        // Preheader: both bounds are evaluated exactly once, before the loop
         llvm::Value *StartVal = m_Start->codegen(gen);
-        if (!StartVal)
+        llvm::Value *EndVal = m_End->codegen(gen);
+        if (!StartVal || !EndVal)
             return nullptr;
-
-        // Make the new basic block for the loop header, inserting after current
-// block.
-        llvm::AllocaInst * VariableAlloca = gen.symbTable.find(m_Var)->second.store;
-        gen.builder.CreateStore(StartVal, VariableAlloca);
+        StartVal = convertValue(gen, StartVal, llvm::Type::getInt32Ty(gen.ctx), "for " + m_Var);
+        EndVal = convertValue(gen, EndVal, llvm::Type::getInt32Ty(gen.ctx), "for " + m_Var);
+        if (m_Parallel)
+            return codegenParallel(gen, StartVal, EndVal);
+        llvm::Value *StepVal = m_Step->codegen(gen);
+        bool Ascending = m_Step->value() > 0;
 
         llvm::Function *TheFunction = gen.builder.GetInsertBlock()->getParent();
-
-        llvm::BasicBlock *ConditionBB =
-                llvm::BasicBlock::Create(gen.ctx, "condb");
-        llvm::BasicBlock *LoopBB =
-                llvm::BasicBlock::Create(gen.ctx, "loopb");
+        llvm::Value *Region = nullptr;
+        if (gen.sourceProfile) {
+            Region = createProfileRegion(gen, TheFunction->getName().str() + ": for " + m_Var, getPosition());
+            profileEnter(gen, Region);
+        }
+        llvm::BasicBlock *PreheaderBB = gen.builder.GetInsertBlock();
+        llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(gen.ctx, "loopb", TheFunction);
+        llvm::BasicBlock *LatchBB = llvm::BasicBlock::Create(gen.ctx, "latchb");
         llvm::BasicBlock *ExitBB = llvm::BasicBlock::Create(gen.ctx, "exitb");
 
-        gen.builder.CreateBr(ConditionBB);
-        gen.builder.SetInsertPoint(ConditionBB);
-
-//        For I := 0 to 20 do then
-//        m_End = <ExprAST>(20)
-        llvm::Value *EndCond = m_End->codegen(gen);
-        if (!EndCond)
-            return nullptr;
-
-        // Convert condition to a bool by comparing non-equal to 0.0.
-        TheFunction->getBasicBlockList().push_back(ConditionBB);
-
-        VariableAlloca = gen.symbTable.find(m_Var)->second.store;
-        llvm::Value * VariableValue = gen.builder.CreateLoad(llvm::Type::getInt32Ty(gen.ctx), VariableAlloca, "for_assign");
-        llvm::Value * condition = gen.builder.CreateICmpSLE(
-                VariableValue, EndCond
-        );
-
-        gen.builder.CreateCondBr(condition, LoopBB, ExitBB);
-
-        TheFunction->getBasicBlockList().push_back(LoopBB);
+        // Guard: an empty range never enters the loop, so the body runs exactly |End - Start| + 1 times
+        llvm::Value *Guard = Ascending ? gen.builder.CreateICmpSLE(StartVal, EndVal, "forguard")
+                                       : gen.builder.CreateICmpSGE(StartVal, EndVal, "forguard");
+        gen.builder.CreateCondBr(Guard, LoopBB, ExitBB);
 
+        // Header: the induction variable lives in a phi, not in the variable's alloca
         gen.builder.SetInsertPoint(LoopBB);
+        llvm::PHINode *IndVar = gen.builder.CreatePHI(llvm::Type::getInt32Ty(gen.ctx), 2, m_Var);
+        IndVar->addIncoming(StartVal, PreheaderBB);
+        if (Region)
+            profileIteration(gen, Region);
+
+        // Control variable is read-only inside the body
+        Symbol Saved = searchIt->second;
+        searchIt->second.value = IndVar;
+        searchIt->second.constant = true;
         // To allow break
         gen.loopExitBlocks.push(ExitBB);
+        emitLocation(gen, *m_Body);
         m_Body->codegen(gen);
         gen.loopExitBlocks.pop();
+        // Looked up again, the body may have restored the table and moved the entry to another node
+        gen.symbTable.at(m_Var) = Saved;
+        // The latch belongs to the loop, not to the last statement of the body
+        emitLocation(gen, *this);
+
+        if (!gen.builder.GetInsertBlock()->getTerminator())
+            gen.builder.CreateBr(LatchBB);
+
+        // Single latch: leave after the iteration for End, otherwise step and go again
+        TheFunction->getBasicBlockList().push_back(LatchBB);
+        gen.builder.SetInsertPoint(LatchBB);
+        llvm::Value *Done = gen.builder.CreateICmpEQ(IndVar, EndVal, "fordone");
+        llvm::Value *NextVal = gen.builder.CreateAdd(IndVar, StepVal, "nextvar");
+        IndVar->addIncoming(NextVal, LatchBB);
+        attachLoopMetadata(gen, gen.builder.CreateCondBr(Done, ExitBB, LoopBB), m_Directives, getPosition());
+
+        // The variable keeps the value it had when the loop was left (Start, End + Step, or the value at break)
+        TheFunction->getBasicBlockList().push_back(ExitBB);
+        gen.builder.SetInsertPoint(ExitBB);
+        llvm::PHINode *FinalVal = gen.builder.CreatePHI(llvm::Type::getInt32Ty(gen.ctx), 2, m_Var + "_final");
+        for (llvm::BasicBlock *Pred : llvm::predecessors(ExitBB)) {
+            if (Pred == PreheaderBB)
+                FinalVal->addIncoming(StartVal, Pred);
+            else if (Pred == LatchBB)
+                FinalVal->addIncoming(NextVal, Pred);
+            else
+                FinalVal->addIncoming(IndVar, Pred);
+        }
+        gen.builder.CreateStore(FinalVal, Saved.store);
+        if (Region)
+            profileExit(gen, Region);
 
-        llvm::Value *StepVal = nullptr;
-        if (m_Step) {
-            StepVal = m_Step->codegen(gen);
-            if (!StepVal)
-                return nullptr;
+        return nullptr;
+    };
+
+    /*
+     * The body is outlined into "<routine>.parallel"(first, last, env), which runs the iterations first..last in
+     * ascending order and is handed to mila_parallel_for of the runtime together with the range. env points to a
+     * struct holding the values of the variables of the routine and the addresses of the reduction variables. The
+     * outlined routine works on copies of the values; every reduction starts from its identity in a variable of the
+     * outlined routine and is combined into the variable of the routine once per chunk, under mila_parallel_lock.
+     */
+    llvm::Value * ForStmtAST::codegenParallel(GenContext &gen, llvm::Value *StartVal, llvm::Value *EndVal) {
+        bool Ascending = m_Step->value() > 0;
+        llvm::AllocaInst *VarStore = gen.symbTable.at(m_Var).store;
+        llvm::Type *Int = llvm::Type::getInt32Ty(gen.ctx);
+        llvm::Function *TheFunction = gen.builder.GetInsertBlock()->getParent();
+        std::string what = "parallel for " + m_Var;
+
+        std::map<std::string, const LoopReduction *> reductions;
+        for (const LoopReduction &reduction : m_Reductions) {
+            auto found = gen.symbTable.find(reduction.var);
+            if (found == gen.symbTable.end() || !found->second.store)
+                throw std::runtime_error("Unknown reduction variable in " + what + ": " + reduction.var);
+            if (found->second.constant || reduction.var == m_Var)
+                throw std::runtime_error("Reduction variable in " + what + " cannot be changed: " + reduction.var);
+            if (!reductions.emplace(reduction.var, &reduction).second)
+                throw std::runtime_error("Reduction variable in " + what + " given twice: " + reduction.var);
         }
-        VariableAlloca = gen.symbTable.find(m_Var)->second.store;
-        VariableValue = gen.builder.CreateLoad(llvm::Type::getInt32Ty(gen.ctx), VariableAlloca, "for_assign");
-        llvm::Value * NextVal = gen.builder.CreateAdd(VariableValue, StepVal, "nextvar");
-        gen.builder.CreateStore(NextVal, VariableAlloca);
 
-        gen.builder.CreateBr(ConditionBB);
+        // Constants are shared as they are, everything else travels in env
+        std::vector<std::pair<std::string, Symbol>> captured;
+        std::vector<llvm::Type *> fields;
+        for (const auto &[name, symbol] : gen.symbTable) {
+            if (name == m_Var || (symbol.value && llvm::isa<llvm::Constant>(symbol.value)))
+                continue;
+            captured.emplace_back(name, symbol);
+            llvm::Type *type = symbol.value ? symbol.value->getType() : symbol.store->getAllocatedType();
+            fields.push_back(reductions.count(name) ? type->getPointerTo() : type);
+        }
+        llvm::StructType *EnvType = llvm::StructType::get(gen.ctx, fields);
+        llvm::IRBuilder<> entryBuilder(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin());
+        llvm::AllocaInst *Env = entryBuilder.CreateAlloca(EnvType, nullptr, "parallelenv");
+        for (size_t i = 0; i < captured.size(); i++) {
+            const Symbol &symbol = captured[i].second;
+            llvm::Value *value = reductions.count(captured[i].first) ? symbol.store
+                    : symbol.value ? symbol.value
+                    : gen.builder.CreateLoad(symbol.store->getAllocatedType(), symbol.store, captured[i].first);
+            gen.builder.CreateStore(value, gen.builder.CreateStructGEP(EnvType, Env, i));
+        }
 
+        llvm::Type *Bytes = llvm::Type::getInt8PtrTy(gen.ctx);
+        llvm::FunctionType *BodyType = llvm::FunctionType::get(llvm::Type::getVoidTy(gen.ctx), {Int, Int, Bytes}, false);
+        llvm::Function *Body = llvm::Function::Create(BodyType, llvm::Function::InternalLinkage,
+                TheFunction->getName() + ".parallel", gen.module);
+        Body->getArg(0)->setName("first");
+        Body->getArg(1)->setName("last");
+        Body->getArg(2)->setName("env");
+
+        // The outlined routine is generated in between, with a state of its own
+        llvm::IRBuilderBase::InsertPoint SavedIP = gen.builder.saveIP();
+        llvm::DebugLoc SavedLoc = gen.builder.getCurrentDebugLocation();
+        Symbol SavedVar = gen.symbTable.at(m_Var);
+        std::stack<llvm::BasicBlock *> SavedExitBlocks;
+        std::swap(SavedExitBlocks, gen.loopExitBlocks);
+        llvm::BasicBlock *SavedTailRecurse = gen.tailRecurseBlock;
+        DebugInfo *SavedDebugInfo = gen.debugInfo;
+        bool SavedProfile = gen.sourceProfile, SavedParallelBody = gen.parallelBody;
+        gen.tailRecurseBlock = nullptr;
+        // No subprogram for the outlined routine, and regions of the profile are not thread safe
+        gen.debugInfo = nullptr;
+        gen.builder.SetCurrentDebugLocation(llvm::DebugLoc());
+        gen.sourceProfile = false;
+        gen.parallelBody = true;
+
+        llvm::BasicBlock *EntryBB = llvm::BasicBlock::Create(gen.ctx, "entry", Body);
+        gen.builder.SetInsertPoint(EntryBB);
+        llvm::Value *BodyEnv = gen.builder.CreateBitCast(Body->getArg(2), EnvType->getPointerTo(), "env");
+        // Slot in the outlined routine, variable of the routine, operation
+        std::vector<std::tuple<llvm::AllocaInst *, llvm::Value *, std::string>> accumulators;
+        for (size_t i = 0; i < captured.size(); i++) {
+            const std::string &name = captured[i].first;
+            llvm::Value *field = gen.builder.CreateLoad(fields[i], gen.builder.CreateStructGEP(EnvType, BodyEnv, i));
+            auto reduction = reductions.find(name);
+            llvm::Type *type = reduction == reductions.end() ? fields[i]
+                    : captured[i].second.store->getAllocatedType();
+            llvm::AllocaInst *slot = gen.builder.CreateAlloca(type, nullptr, name);
+            if (reduction == reductions.end()) {
+                gen.builder.CreateStore(field, slot);
+                gen.symbTable[name] = {slot, captured[i].second.constant};
+                continue;
+            }
+            // Identity of the operation
+            const std::string &op = reduction->second->op;
+            llvm::Value *identity;
+            if (type->isDoubleTy())
+                identity = op == "+" ? llvm::ConstantFP::get(type, 0.0) : llvm::ConstantFP::getInfinity(type, op == "max");
+            else
+                identity = op == "+" ? llvm::ConstantInt::get(type, 0)
+                        : op == "min" ? llvm::ConstantInt::get(type, llvm::APInt::getSignedMaxValue(32))
+                        : llvm::ConstantInt::get(type, llvm::APInt::getSignedMinValue(32));
+            gen.builder.CreateStore(identity, slot);
+            gen.symbTable[name] = {slot, false};
+            accumulators.emplace_back(slot, field, op);
+        }
+        llvm::AllocaInst *VarSlot = gen.builder.CreateAlloca(Int, nullptr, m_Var);
+        llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(gen.ctx, "loopb", Body);
+        llvm::BasicBlock *LatchBB = llvm::BasicBlock::Create(gen.ctx, "latchb");
+        llvm::BasicBlock *ExitBB = llvm::BasicBlock::Create(gen.ctx, "exitb");
+        gen.builder.CreateBr(LoopBB);
 
-        TheFunction->getBasicBlockList().push_back(ExitBB);
+        // The runtime never passes an empty range
+        gen.builder.SetInsertPoint(LoopBB);
+        llvm::PHINode *IndVar = gen.builder.CreatePHI(Int, 2, m_Var);
+        IndVar->addIncoming(Body->getArg(0), EntryBB);
+        gen.symbTable[m_Var] = {VarSlot, true, IndVar};
+        m_Body->codegen(gen);
+        if (!gen.builder.GetInsertBlock()->getTerminator())
+            gen.builder.CreateBr(LatchBB);
+
+        Body->getBasicBlockList().push_back(LatchBB);
+        gen.builder.SetInsertPoint(LatchBB);
+        llvm::Value *Done = gen.builder.CreateICmpEQ(IndVar, Body->getArg(1), "fordone");
+        llvm::Value *NextVal = gen.builder.CreateAdd(IndVar, gen.builder.getInt32(1), "nextvar");
+        IndVar->addIncoming(NextVal, LatchBB);
+        attachLoopMetadata(gen, gen.builder.CreateCondBr(Done, ExitBB, LoopBB), m_Directives, getPosition());
+
+        Body->getBasicBlockList().push_back(ExitBB);
         gen.builder.SetInsertPoint(ExitBB);
+        if (!accumulators.empty()) {
+            gen.builder.CreateCall(gen.module.getFunction("mila_parallel_lock"));
+            for (auto &[slot, shared, op] : accumulators) {
+                llvm::Type *type = slot->getAllocatedType();
+                llvm::Value *Mine = gen.builder.CreateLoad(type, slot);
+                llvm::Value *Theirs = gen.builder.CreateLoad(type, shared);
+                llvm::Value *Combined;
+                if (op == "+")
+                    Combined = type->isDoubleTy() ? gen.builder.CreateFAdd(Theirs, Mine) : gen.builder.CreateAdd(Theirs, Mine);
+                else if (type->isDoubleTy())
+                    Combined = gen.builder.CreateSelect(op == "min" ? gen.builder.CreateFCmpOLT(Mine, Theirs)
+                                                                    : gen.builder.CreateFCmpOGT(Mine, Theirs), Mine, Theirs);
+                else
+                    Combined = gen.builder.CreateSelect(op == "min" ? gen.builder.CreateICmpSLT(Mine, Theirs)
+                                                                    : gen.builder.CreateICmpSGT(Mine, Theirs), Mine, Theirs);
+                gen.builder.CreateStore(Combined, shared);
+            }
+            gen.builder.CreateCall(gen.module.getFunction("mila_parallel_unlock"));
+        }
+        gen.builder.CreateRetVoid();
 
+        gen.builder.restoreIP(SavedIP);
+        gen.builder.SetCurrentDebugLocation(SavedLoc);
+        // Only the entries the outlined routine replaced, the nodes of the table stay where enclosing loops have them
+        for (const auto &[name, symbol] : captured)
+            gen.symbTable.at(name) = symbol;
+        gen.symbTable.at(m_Var) = SavedVar;
+        std::swap(SavedExitBlocks, gen.loopExitBlocks);
+        gen.tailRecurseBlock = SavedTailRecurse;
+        gen.debugInfo = SavedDebugInfo;
+        gen.sourceProfile = SavedProfile;
+        gen.parallelBody = SavedParallelBody;
+
+        // The runtime gets the range in ascending order
+        llvm::Value *First = Ascending ? StartVal : EndVal, *Last = Ascending ? EndVal : StartVal;
+        llvm::Value *Ran = gen.builder.CreateICmpSLE(First, Last, "forguard");
+        llvm::Value *Region = nullptr;
+        if (gen.sourceProfile) {
+            // Routines the body calls are not timed, the time of the whole loop goes to its region
+            Region = createProfileRegion(gen, TheFunction->getName().str() + ": parallel for " + m_Var, getPosition());
+            profileEnter(gen, Region);
+            llvm::Type *Long = gen.builder.getInt64Ty();
+            llvm::Value *Count = gen.builder.CreateAdd(gen.builder.CreateSub(gen.builder.CreateSExt(Last, Long),
+                    gen.builder.CreateSExt(First, Long)), gen.builder.getInt64(1));
+            profileIteration(gen, Region, gen.builder.CreateSelect(Ran, Count, gen.builder.getInt64(0)));
+        }
+        gen.builder.CreateCall(gen.module.getFunction("mila_parallel_for"),
+                               {First, Last, Body, gen.builder.CreateBitCast(Env, Bytes)});
+        if (Region)
+            profileExit(gen, Region);
+
+        // The variable is left as after a sequential loop, break is not allowed in the body
+        llvm::Value *After = gen.builder.CreateAdd(EndVal, m_Step->codegen(gen), m_Var + "_final");
+        gen.builder.CreateStore(gen.builder.CreateSelect(Ran, After, StartVal), VarStore);
         return nullptr;
-    };
+    }
+
+    void ForStmtAST::markTailCalls(const PrototypeAST &proto, bool) {
+        // The loop continues after its body, only statements followed by exit can be tail calls
+        m_Body->markTailCalls(proto, false);
+    }
+    void ForStmtAST::collectCallees(std::set<std::string> &callees) const {
+        m_Start->collectCallees(callees);
+        m_End->collectCallees(callees);
+        m_Body->collectCallees(callees);
+    }
+    void ForStmtAST::forEachChild(const std::function<void(const AST &)> &visit) const {
+        visit(*m_Start);
+        visit(*m_End);
+        if (m_Step)
+            visit(*m_Step);
+        visit(*m_Body);
+    }
 
 WhileStmtAST::WhileStmtAST(std::unique_ptr<ExprAST> cond, std::unique_ptr<AST> body)
             : m_Cond(std::move(cond)), m_Body(std::move(body)) {}
@@ -595,6 +1364,10 @@ WhileStmtAST::WhileStmtAST(std::unique_ptr<ExprAST> cond, std::unique_ptr<AST> b
     void WhileStmtAST::print(std::ostream &out, int indent ) const {
         out << std::string(indent, ' ') << "{\n";
         out << std::string(indent + 2, ' ') << "\"type\": \"WHILE\",\n";
+        if (!m_Directives.empty()) {
+            out << std::string(indent + 2, ' ') << "\"directives\": \"" << m_Directives.describe() << "\",\n";
+            out << std::string(indent + 2, ' ') << "\"line\": " << getPosition().getLine() << ",\n";
+        }
         m_Cond->print(out, indent + 2);
         m_Body->print(out, indent + 2);
         out << std::string(indent, ' ') << "}";
@@ -606,28 +1379,46 @@ WhileStmtAST::WhileStmtAST(std::unique_ptr<ExprAST> cond, std::unique_ptr<AST> b
         llvm::BasicBlock *CondBB = llvm::BasicBlock::Create(gen.ctx, "whilecond", TheFunction);
         llvm::BasicBlock *LoopBB = llvm::BasicBlock::Create(gen.ctx, "whileloop" );
         llvm::BasicBlock *ExitBB = llvm::BasicBlock::Create(gen.ctx, "whileexit");
+        llvm::Value *Region = nullptr;
+        if (gen.sourceProfile) {
+            Region = createProfileRegion(gen, TheFunction->getName().str() + ": while", getPosition());
+            profileEnter(gen, Region);
+        }
 
         gen.builder.CreateBr(CondBB);
         gen.builder.SetInsertPoint(CondBB);
 
-        llvm::Value *CondV = m_Cond->codegen(gen);
-        if (!CondV)
-            return nullptr;
-
-        CondV = gen.builder.CreateICmpNE(CondV, llvm::ConstantInt::get(CondV->getType(), 0, true), "whilecond");
-        gen.builder.CreateCondBr(CondV, LoopBB, ExitBB);
+        m_Cond->codegenBranch(gen, LoopBB, ExitBB);
 
         TheFunction->getBasicBlockList().push_back(LoopBB);
         gen.builder.SetInsertPoint(LoopBB);
+        if (Region)
+            profileIteration(gen, Region);
 
         gen.loopExitBlocks.push(ExitBB);
+        emitLocation(gen, *m_Body);
         m_Body->codegen(gen);
         gen.loopExitBlocks.pop();
 
-        gen.builder.CreateBr(CondBB);
+        emitLocation(gen, *this);
+        attachLoopMetadata(gen, gen.builder.CreateBr(CondBB), m_Directives, getPosition());
 
         TheFunction->getBasicBlockList().push_back(ExitBB);
         gen.builder.SetInsertPoint(ExitBB);
+        if (Region)
+            profileExit(gen, Region);
 
         return nullptr;
     }
+
+    void WhileStmtAST::markTailCalls(const PrototypeAST &proto, bool) {
+        m_Body->markTailCalls(proto, false);
+    }
+    void WhileStmtAST::collectCallees(std::set<std::string> &callees) const {
+        m_Cond->collectCallees(callees);
+        m_Body->collectCallees(callees);
+    }
+    void WhileStmtAST::forEachChild(const std::function<void(const AST &)> &visit) const {
+        visit(*m_Cond);
+        visit(*m_Body);
+    }
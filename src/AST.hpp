@@ -11,6 +11,7 @@
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/CFG.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
@@ -22,7 +23,12 @@
 #include <llvm/IR/Verifier.h>
 
 #include <deque>
+#include <functional>
+#include <optional>
+#include <set>
 #include "Lexer.hpp"
+#include "Position.hpp"
+#include "TimeReport.hpp"
 #include <stack>
 
 #ifndef MILA_AST_HPP
@@ -30,11 +36,15 @@
 
 
 class TypeAST;
+class PrototypeAST;
+class DebugInfo;
 
 struct Symbol {
     llvm::AllocaInst* store;
 //    Whether constant variable or not
     bool constant;
+//    SSA value bound to the symbol (e.g. for-loop induction variable), read instead of store when set
+    llvm::Value* value = nullptr;
 };
 
 
@@ -95,6 +105,20 @@ struct GenContext {
 
     std::stack<llvm::BasicBlock*> loopExitBlocks;
     SymbolTable symbTable;
+    // Symbols every routine starts with: constants of the unit being compiled and of the units it uses
+    SymbolTable globalSymbols;
+    // Block self tail calls of the current function jump back to
+    llvm::BasicBlock* tailRecurseBlock = nullptr;
+    // Where verification time goes with --time-report, null otherwise
+    TimeReport *timeReport = nullptr;
+    // Routines and loops are timed at run time (--profile), see SourceProfile.hpp
+    bool sourceProfile = false;
+    // DWARF of the module (-g), null otherwise
+    DebugInfo *debugInfo = nullptr;
+    // Floating-point operations may be reassociated and contracted (--fast-math)
+    bool fastMath = false;
+    // Generating the body of a parallel for, which runs in a routine of its own
+    bool parallelBody = false;
 };
 
 
@@ -108,6 +132,20 @@ public:
         return out;
     }
     virtual llvm::Value * codegen(GenContext& gen ) = 0;
+    // Marks calls whose result the enclosing routine returns directly, tail says whether this node is in tail position
+    virtual void markTailCalls(const PrototypeAST &, bool) {}
+    // Adds the names of all routines called in this subtree
+    virtual void collectCallees(std::set<std::string> &) const {}
+    // Calls visit on every direct child node
+    virtual void forEachChild(const std::function<void(const AST &)> &) const {}
+    // Number of nodes in this subtree, this one included
+    size_t countNodes() const;
+    // Where the node starts in the source, 0:0 for nodes the parser made up
+    const Position &getPosition() const { return m_Position; }
+    void setPosition(const Position &position) { m_Position = position; }
+
+private:
+    Position m_Position;
 };
 
 class ExprAST : public AST {
@@ -115,6 +153,13 @@ public:
     virtual ~ExprAST() = default;
 //    virtual void print(std::ostream &out, int indent = 0) const = 0;
     virtual const std::string &getName() const = 0;
+
+    // Whether the expression is a truth value (comparison or logical operator on truth values)
+    virtual bool isBoolean() const { return false; }
+    // Generates the expression as an i1 truth value
+    virtual llvm::Value * codegenCondition(GenContext& gen);
+    // Generates the expression as control flow, jumping to TrueBB or FalseBB
+    virtual void codegenBranch(GenContext& gen, llvm::BasicBlock *TrueBB, llvm::BasicBlock *FalseBB);
 };
 
 class StatementAST : public AST {
@@ -131,6 +176,10 @@ public:
 
     void print(std::ostream &out, int indent = 0) const override ;
     llvm::Value * codegen(GenContext& gen) override ;
+    void markTailCalls(const PrototypeAST &proto, bool tail) override;
+    void collectCallees(std::set<std::string> &callees) const override;
+    void forEachChild(const std::function<void(const AST &)> &visit) const override;
+    const std::vector<std::unique_ptr<AST>> &getBody() const { return m_Body; }
 };
 
 class TypeAST : public AST {
@@ -143,6 +192,9 @@ public:
 //    llvm::Value* codegen(GenContext& gen) const override;
     void print(std::ostream &out, int indent = 0) const override;
     llvm::Value * codegen(GenContext& gen) override;
+    Type getType() const { return m_type; }
+    // i32 for integer, double for real
+    static llvm::Type *getLLVMType(llvm::LLVMContext &ctx, Type type);
 private:
     Type m_type;
 };
@@ -152,11 +204,22 @@ class NumberExprAST : public ExprAST {
 public:
     NumberExprAST(int val) ;
     const std::string &getName() const override ;
+    int value() const { return m_Val; }
 
     void print(std::ostream &out, int indent = 0) const override ;
     llvm::Value * codegen(GenContext& gen) override ;
 };
 
+class RealExprAST : public ExprAST {
+    double m_Val;
+public:
+    RealExprAST(double val);
+    const std::string &getName() const override;
+
+    void print(std::ostream &out, int indent = 0) const override;
+    llvm::Value * codegen(GenContext& gen) override;
+};
+
 
 class DeclRefAST : public ExprAST {
     std::string m_Var;
@@ -181,6 +244,13 @@ public:
 
     void print(std::ostream &out, int indent = 0) const override;
     llvm::Value* codegen(GenContext &gen) override;
+    // Evaluates a unit constant and makes it visible in every routine, returns its value
+    int codegenUnitConstant(GenContext &gen);
+    void collectCallees(std::set<std::string> &callees) const override;
+    void forEachChild(const std::function<void(const AST &)> &visit) const override;
+    const std::string &getName() const { return m_var; }
+    bool isConstant() const { return m_constant; }
+    TypeAST::Type getType() const { return m_type ? m_type->getType() : TypeAST::Type::INT; }
 
 //    llvm::Value* codegen(GenContext& gen) const override;
 };
@@ -198,14 +268,40 @@ public:
 
     void print(std::ostream &out, int indent = 0) const override;
     llvm::Value * codegen(GenContext& gen) override;
+    bool isBoolean() const override;
+    llvm::Value * codegenCondition(GenContext& gen) override;
+    void codegenBranch(GenContext& gen, llvm::BasicBlock *TrueBB, llvm::BasicBlock *FalseBB) override;
 
     llvm::Value * codegenAssignment(GenContext & gen);
+    void markTailCalls(const PrototypeAST &proto, bool tail) override;
+    void collectCallees(std::set<std::string> &callees) const override;
+    void forEachChild(const std::function<void(const AST &)> &visit) const override;
+};
+
+/// UnaryExprAST - Expression class for a unary operator (not).
+class UnaryExprAST : public ExprAST {
+    char Op;
+    std::unique_ptr<ExprAST> m_Operand;
+
+public:
+    UnaryExprAST(char Op, std::unique_ptr<ExprAST> Operand);
+
+    const std::string &getName() const override;
+
+    void print(std::ostream &out, int indent = 0) const override;
+    llvm::Value * codegen(GenContext& gen) override;
+    bool isBoolean() const override;
+    llvm::Value * codegenCondition(GenContext& gen) override;
+    void codegenBranch(GenContext& gen, llvm::BasicBlock *TrueBB, llvm::BasicBlock *FalseBB) override;
+    void collectCallees(std::set<std::string> &callees) const override;
+    void forEachChild(const std::function<void(const AST &)> &visit) const override;
 };
 
 /// CallExprAST - Expression class for function calls.
 class CallExprAST : public ExprAST {
     std::string Callee;
     std::vector<std::unique_ptr<ExprAST>> Args;
+    bool m_TailCall = false;
 
 public:
     CallExprAST(std::string Callee, std::vector<std::unique_ptr<ExprAST>> Args);
@@ -214,22 +310,34 @@ public:
     void print(std::ostream &out, int indent = 0) const override ;
     llvm::Value * PredefinedFunctions(GenContext& gen) ;
     llvm::Value * codegen(GenContext& gen) override ;
+    void markTailCalls(const PrototypeAST &proto, bool tail) override;
+    void setTailCall() { m_TailCall = true; }
+    void collectCallees(std::set<std::string> &callees) const override;
+    void forEachChild(const std::function<void(const AST &)> &visit) const override;
+private:
+    llvm::Value * codegenTailCall(GenContext& gen, llvm::Function * calleeF, const std::vector<llvm::Value *> & argsV);
 };
 
 /// PrototypeAST - This class represents the "prototype" for a function,
 /// which captures its name, and its argument names (thus implicitly the number
 /// of arguments the function takes).
-class PrototypeAST : StatementAST  {
+class PrototypeAST : public StatementAST  {
     std::string m_Name;
     std::vector<std::string> m_Args;
     std::unique_ptr<VarDeclAST> m_Return;
+    std::vector<TypeAST::Type> m_ArgTypes;
 public:
-    PrototypeAST(const std::string &Name, std::vector<std::string> Args, std::unique_ptr<VarDeclAST> Return);
+    // ArgTypes lists the type of every argument, all of them are integers when it is empty
+    PrototypeAST(const std::string &Name, std::vector<std::string> Args, std::unique_ptr<VarDeclAST> Return,
+                 std::vector<TypeAST::Type> ArgTypes = {});
 
     const std::string &getName() const ;
+    // Procedures have no return variable, main is not one of them
+    bool isProcedure() const { return m_Return == nullptr && m_Name != "main"; }
 
     void print(std::ostream &out, int indent = 0) const override ;
     llvm::Function * codegen(GenContext& gen) override;
+    void forEachChild(const std::function<void(const AST &)> &visit) const override;
 };
 
 /// FunctionAST - This class represents a function definition itself.
@@ -243,6 +351,10 @@ public:
 
     void print(std::ostream &out, int indent = 0) const  override ;
     llvm::Value * codegen(GenContext& gen) override ;
+    void collectCallees(std::set<std::string> &callees) const override;
+    void forEachChild(const std::function<void(const AST &)> &visit) const override;
+    PrototypeAST &getPrototype() { return *m_Proto; }
+    bool hasBody() const { return m_Body != nullptr; }
 };
 
 class FunctionExitAST : public StatementAST {
@@ -263,15 +375,43 @@ public:
 
 
 class IfStmtAST : public StatementAST {
-    std::unique_ptr<AST> m_Cond, m_Then, m_Else;
+    std::unique_ptr<ExprAST> m_Cond;
+    std::unique_ptr<AST> m_Then, m_Else;
 
 public:
-    IfStmtAST(std::unique_ptr<AST> cond, std::unique_ptr<AST> then,
+    IfStmtAST(std::unique_ptr<ExprAST> cond, std::unique_ptr<AST> then,
               std::unique_ptr<AST> Else);
 
     void print(std::ostream &out, int indent = 0) const override ;
 
     llvm::Value *codegen(GenContext & gen) override;
+    void markTailCalls(const PrototypeAST &proto, bool tail) override;
+    void collectCallees(std::set<std::string> &callees) const override;
+    void forEachChild(const std::function<void(const AST &)> &visit) const override;
+};
+
+/**
+ * @brief What the {$...} directives in front of a loop ask the optimiser for.
+ *
+ * Emitted as llvm.loop metadata on the latch branch; they only take effect from -O1 on. Transformations that were
+ * asked for but could not be done are reported as warnings by optimizeModule.
+ */
+struct LoopDirectives {
+    std::optional<bool> vectorize;   // {$vectorize} or {$novectorize}
+    unsigned vectorizeWidth = 0;     // {$vectorize width=N}, 0 leaves it to the cost model
+    unsigned interleaveCount = 0;    // {$interleave N}
+    std::optional<bool> unroll;      // {$unroll [N]} or {$nounroll}
+    unsigned unrollCount = 0;        // {$unroll N}, 0 unrolls fully
+
+    bool empty() const;
+    // The directives as written, for printing and cache keys
+    std::string describe() const;
+};
+
+// reduce Var: Op of a parallel for, Op is "+", "min" or "max"
+struct LoopReduction {
+    std::string var;
+    std::string op;
 };
 
 class ForStmtAST : public StatementAST {
@@ -279,25 +419,45 @@ class ForStmtAST : public StatementAST {
     std::unique_ptr<ExprAST> m_Start, m_End;
     std::unique_ptr<NumberExprAST> m_Step;
     std::unique_ptr<AST> m_Body;
+    LoopDirectives m_Directives;
+    bool m_Parallel = false;
+    std::vector<LoopReduction> m_Reductions;
+
+    llvm::Value *codegenParallel(GenContext &gen, llvm::Value *StartVal, llvm::Value *EndVal);
 
 public:
     ForStmtAST(const std::string &Var, std::unique_ptr<ExprAST> Start,
                std::unique_ptr<ExprAST> End, std::unique_ptr<NumberExprAST> Step,
                std::unique_ptr<AST> Body) ;
     void print(std::ostream &out, int indent = 0) const override  ;
+    void setDirectives(const LoopDirectives &directives) { m_Directives = directives; }
+    // parallel for: the body runs on the threads of the runtime, on copies of the variables of the routine taken
+    // when the loop starts; only the reductions are combined back into the routine
+    void setParallel(std::vector<LoopReduction> reductions) {
+        m_Parallel = true;
+        m_Reductions = std::move(reductions);
+    }
 
     llvm::Value *codegen(GenContext & gen) override ;
+    void markTailCalls(const PrototypeAST &proto, bool tail) override;
+    void collectCallees(std::set<std::string> &callees) const override;
+    void forEachChild(const std::function<void(const AST &)> &visit) const override;
 };
 
 class WhileStmtAST : public StatementAST {
     std::unique_ptr<ExprAST> m_Cond;
     std::unique_ptr<AST> m_Body;
+    LoopDirectives m_Directives;
 
 public:
     WhileStmtAST(std::unique_ptr<ExprAST> cond, std::unique_ptr<AST> body);
+    void setDirectives(const LoopDirectives &directives) { m_Directives = directives; }
 
     void print(std::ostream &out, int indent = 0) const override ;
     llvm::Value *codegen(GenContext &gen) override ;
+    void markTailCalls(const PrototypeAST &proto, bool tail) override;
+    void collectCallees(std::set<std::string> &callees) const override;
+    void forEachChild(const std::function<void(const AST &)> &visit) const override;
 };
 
 
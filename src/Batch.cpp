@@ -0,0 +1,84 @@
+#include "Batch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <thread>
+
+#include "ObjectEmitter.hpp"
+#include "Optimizer.hpp"
+#include "Parser.hpp"
+
+namespace {
+
+std::string stem(const std::string &path) {
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+void compileOne(const std::string &input, const std::string &output, const BatchOptions &options) {
+    std::ifstream source(input);
+    if (!source)
+        throw std::runtime_error("cannot open the source file");
+
+    Parser parser(source);
+    for (const std::string &dir : options.interfaceDirs)
+        parser.addInterfaceDir(dir);
+    parser.setInterfaceFile(output + ".mili");
+    if (options.debugInfo)
+        parser.setDebugInfo(input);
+    parser.setFastMath(options.fastMath);
+    if (!parser.Parse())
+        throw std::runtime_error("parsing failed");
+    llvm::Module &module = parser.Generate();
+    optimizeModule(module, options.optLevel);
+    emitObject(module, output + ".o");
+}
+
+}
+
+size_t compileBatch(const std::vector<std::string> &inputs, const BatchOptions &options) {
+    std::vector<std::string> errors(inputs.size());
+
+    // Two inputs with the same name would overwrite each other's output
+    std::map<std::string, size_t> owners;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        auto owner = owners.emplace(stem(inputs[i]), i);
+        if (!owner.second)
+            errors[i] = "same output name as " + inputs[owner.first->second];
+    }
+
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < inputs.size(); i = next++) {
+            if (!errors[i].empty())
+                continue;
+            try {
+                compileOne(inputs[i], options.outputDir + "/" + stem(inputs[i]), options);
+            } catch (const std::exception &e) {
+                errors[i] = e.what();
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < std::max(1u, options.jobs); t++)
+        threads.emplace_back(worker);
+    for (std::thread &thread : threads)
+        thread.join();
+
+    size_t failed = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (errors[i].empty())
+            continue;
+        std::cerr << inputs[i] << ": " << errors[i] << std::endl;
+        failed++;
+    }
+    std::cerr << "Batch: " << inputs.size() - failed << " of " << inputs.size() << " compiled, "
+              << failed << " failed" << std::endl;
+    return failed;
+}
@@ -0,0 +1,26 @@
+#ifndef MILA_BATCH_HPP
+#define MILA_BATCH_HPP
+
+#include <string>
+#include <vector>
+
+struct BatchOptions {
+    unsigned optLevel = 0;
+    unsigned jobs = 1;
+    std::string outputDir = ".";
+    std::vector<std::string> interfaceDirs;
+    // DWARF for every input (-g)
+    bool debugInfo = false;
+    // Reassociation of floating-point operations (--fast-math)
+    bool fastMath = false;
+};
+
+/**
+ * @brief Compiles many sources in this process, each on a thread of the pool and with a GenContext of its own.
+ *
+ * Every input becomes <outputDir>/<name>.o (units also get their <name>.mili there). Failures are listed on
+ * stderr in input order followed by a summary. Returns the number of inputs that failed.
+ */
+size_t compileBatch(const std::vector<std::string> &inputs, const BatchOptions &options);
+
+#endif // MILA_BATCH_HPP
@@ -0,0 +1,184 @@
+#include "CompileServer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "CompilerOptions.hpp"
+#include "ObjectEmitter.hpp"
+#include "Optimizer.hpp"
+#include "Parser.hpp"
+#include "ServerProtocol.hpp"
+
+namespace {
+
+// Copy of the socket path for the signal handler, which may only call async-signal-safe functions
+char g_SocketPath[sizeof(sockaddr_un::sun_path)];
+
+void removeSocketAndExit(int) {
+    ::unlink(g_SocketPath);
+    ::_exit(0);
+}
+
+/// Compiles one request into output, the IR, the objects of --incremental or nothing when an object was asked for.
+/// Throws on errors. errors receives what goes to the client's stderr besides errors: warnings and the time report.
+bool compile(const std::vector<std::string> &request, std::string &output, std::ostream &errors) {
+    // request: "compile", cwd, arguments..., source
+    CompilerOptions options = parseCompilerOptions({request.begin() + 2, request.end() - 1}, request[1]);
+    // mila-client runs anything else in a process of its own
+    if (!options.servable())
+        throw std::runtime_error("The compile server cannot do this, run the compiler directly");
+    const std::string &timeReportFormat = options.timeReportFormat;
+    std::istringstream source(request.back());
+    Parser parser(source);
+    parser.setOptions(options);
+    parser.setDiagnostics(errors);
+    TimeReport timeReport;
+    TimeReport *report = timeReportFormat.empty() ? nullptr : &timeReport;
+    parser.setTimeReport(report);
+
+    if (!parser.Parse())
+        return false;
+    if (!options.incrementalDir.empty()) {
+        if (!options.profileGenerate.empty() || !options.profileUse.empty() || options.sourceProfile)
+            throw std::runtime_error("Profiles are not supported with --incremental");
+        for (const std::string &object : parser.GenerateIncremental(options.incrementalDir, options.optLevel))
+            output += object + "\n";
+        return true;
+    }
+    llvm::Module &module = parser.Generate();
+    if (report)
+        report->addModuleCounts(module, "generated");
+    optimizeModule(module, options.optLevel, report, errors);
+    if (report && options.optLevel > 0)
+        report->addModuleCounts(module, "optimised");
+    {
+        TimeReport::Scope scope(report, "emission");
+        if (!options.objectPath.empty()) {
+            emitObject(module, options.objectPath);
+        } else {
+            llvm::raw_string_ostream out(output);
+            module.print(out, nullptr);
+            out.flush();
+        }
+    }
+
+    // The report goes where the compiler prints it, to stderr
+    if (timeReportFormat == "json")
+        timeReport.printJson(errors);
+    else if (report)
+        timeReport.printTable(errors);
+    return true;
+}
+
+class Server {
+public:
+    explicit Server(int listener) : m_Listener(listener) {}
+
+    void run() {
+        while (!m_Stopping) {
+            int client = ::accept(m_Listener, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Active++;
+            std::thread(&Server::serve, this, client).detach();
+        }
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Idle.wait(lock, [this] { return m_Active == 0; });
+    }
+
+private:
+    void serve(int client) {
+        std::vector<std::string> request;
+        if (server::receiveMessage(client, request) && !request.empty()) {
+            if (request[0] == "shutdown") {
+                m_Stopping = true;
+                server::sendMessage(client, {"0", "", ""});
+                // Wakes up the accept in run()
+                ::shutdown(m_Listener, SHUT_RDWR);
+            } else if (request[0] == "compile" && request.size() >= 3) {
+                std::string output;
+                // Warnings given before an error are kept
+                std::ostringstream errors;
+                bool compiled = false;
+                try {
+                    compiled = compile(request, output, errors);
+                } catch (const std::exception &e) {
+                    errors << e.what() << "\n";
+                } catch (...) {
+                    // Whatever a request throws, the server stays up for the other clients
+                    errors << "Internal compiler error\n";
+                }
+                server::sendMessage(client, {compiled ? "0" : "1", output, errors.str()});
+            } else {
+                server::sendMessage(client, {"2", "", "Unknown request: " + request[0] + "\n"});
+            }
+        }
+        ::close(client);
+
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (--m_Active == 0)
+            m_Idle.notify_all();
+    }
+
+    int m_Listener;
+    std::atomic<bool> m_Stopping{false};
+    std::mutex m_Mutex;
+    std::condition_variable m_Idle;
+    unsigned m_Active = 0;
+};
+
+}
+
+int runCompileServer(const std::string &socketPath) {
+    sockaddr_un address{};
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socketPath << std::endl;
+        return 1;
+    }
+    // A socket nobody listens on is a leftover of a server that was killed
+    int running = server::connectTo(socketPath);
+    if (running >= 0) {
+        ::close(running);
+        std::cerr << "A compile server already listens on " << socketPath << std::endl;
+        return 1;
+    }
+    ::unlink(socketPath.c_str());
+
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, socketPath.c_str());
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+        || ::listen(listener, SOMAXCONN) != 0) {
+        std::cerr << "Cannot listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    std::strcpy(g_SocketPath, socketPath.c_str());
+    std::signal(SIGINT, removeSocketAndExit);
+    std::signal(SIGTERM, removeSocketAndExit);
+
+    // The parser's tracing of concurrent requests would only interleave
+    std::clog.rdbuf(nullptr);
+    Server(listener).run();
+
+    ::close(listener);
+    ::unlink(socketPath.c_str());
+    return 0;
+}
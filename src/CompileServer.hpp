@@ -0,0 +1,17 @@
+#ifndef MILA_COMPILESERVER_HPP
+#define MILA_COMPILESERVER_HPP
+
+#include <string>
+
+/**
+ * @brief Serves compile requests of mila-client on a Unix domain socket until a shutdown request arrives.
+ *
+ * The process stays up between requests, so the LLVM libraries are loaded and the target initialised only
+ * once. Every connection is served on a thread of its own with its own Parser and GenContext. Requests take the
+ * arguments of the compiler (see CompilerOptions.hpp, the modes it does not call servable are left to the client)
+ * and the source; relative paths are resolved against the client's working directory. Returns the exit status of
+ * the server.
+ */
+int runCompileServer(const std::string &socketPath);
+
+#endif // MILA_COMPILESERVER_HPP
@@ -0,0 +1,71 @@
+#include "CompilerOptions.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+bool CompilerOptions::servable() const {
+    // The memory report counts the allocations of the whole process
+    return !batch && !serve && testDir.empty() && !memoryReport;
+}
+
+CompilerOptions parseCompilerOptions(const std::vector<std::string> &args, const std::string &cwd) {
+    auto path = [&cwd](const std::string &path) {
+        return cwd.empty() || path.empty() || path[0] == '/' ? path : cwd + "/" + path;
+    };
+    CompilerOptions options;
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string &arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '3') {
+            options.optLevel = arg[2] - '0';
+        } else if (arg == "-I" && hasValue) {
+            options.interfaceDirs.push_back(path(args[++i]));
+        } else if (arg == "--interface" && hasValue) {
+            options.interfaceFile = path(args[++i]);
+        } else if ((arg == "-j" || arg == "--jobs") && hasValue) {
+            options.jobs = std::max(1, std::atoi(args[++i].c_str()));
+        } else if (arg == "--incremental" && hasValue) {
+            options.incrementalDir = path(args[++i]);
+        } else if (arg == "--batch") {
+            options.batch = true;
+        } else if (arg == "--output-dir" && hasValue) {
+            options.outputDir = path(args[++i]);
+        } else if (arg == "--object" && hasValue) {
+            options.objectPath = path(args[++i]);
+        } else if (arg == "--serve") {
+            options.serve = true;
+        } else if (arg == "--socket" && hasValue) {
+            options.socketPath = path(args[++i]);
+        } else if (arg == "--time-report" || arg == "--time-report=table" || arg == "--time-report=json") {
+            options.timeReportFormat = arg == "--time-report=json" ? "json" : "table";
+        } else if (arg == "--mem-report") {
+            options.memoryReport = true;
+        } else if (arg == "-g") {
+            options.debugInfo = true;
+        } else if (arg == "--source-name" && hasValue) {
+            options.sourceName = path(args[++i]);
+        } else if (arg == "--fast-math") {
+            options.fastMath = true;
+        } else if (arg == "--profile") {
+            options.sourceProfile = true;
+        } else if (arg == "--profile-generate" || arg.compare(0, 19, "--profile-generate=") == 0) {
+            options.profileGenerate = path(arg.size() > 19 ? arg.substr(19) : "mila.profile");
+        } else if (arg == "--profile-use" && hasValue) {
+            options.profileUse = path(args[++i]);
+        } else if (arg.compare(0, 14, "--profile-use=") == 0 && arg.size() > 14) {
+            options.profileUse = path(arg.substr(14));
+        } else if (arg == "--test-dir" && hasValue) {
+            options.testDir = path(args[++i]);
+        } else if (arg == "--samples" && hasValue) {
+            options.sampleDir = path(args[++i]);
+        } else if (arg == "--perf") {
+            options.perf = true;
+        } else if (options.batch && !arg.empty() && arg[0] != '-') {
+            options.inputs.push_back(path(arg));
+        } else {
+            throw std::runtime_error("Unknown argument: " + arg);
+        }
+    }
+    return options;
+}
@@ -0,0 +1,47 @@
+#ifndef MILA_COMPILEROPTIONS_HPP
+#define MILA_COMPILEROPTIONS_HPP
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief The command line of the compiler (build/mila), read in one place by the compiler itself, the compile
+ * server and mila-client.
+ *
+ * Free of LLVM, mila-client uses it to tell which requests the server can take.
+ */
+struct CompilerOptions {
+    unsigned optLevel = 0;
+    // 0 when not given, the modes pick their own default then
+    unsigned jobs = 0;
+    std::string incrementalDir;
+    std::string interfaceFile;
+    std::vector<std::string> interfaceDirs;
+    bool batch = false;
+    std::string outputDir = ".";
+    std::vector<std::string> inputs;
+    std::string objectPath;
+    bool serve = false;
+    std::string socketPath;
+    // Empty without --time-report, else "table" or "json"
+    std::string timeReportFormat;
+    bool memoryReport = false;
+    std::string testDir;
+    std::string sampleDir = "samples";
+    bool perf = false;
+    std::string profileGenerate;
+    std::string profileUse;
+    bool sourceProfile = false;
+    bool debugInfo = false;
+    std::string sourceName = "<stdin>";
+    bool fastMath = false;
+
+    /// Whether the compile server can do it: one program from stdin and nothing kept for the whole process
+    bool servable() const;
+};
+
+/// Reads the arguments of the compiler, relative paths are resolved against cwd unless it is empty.
+/// Throws std::runtime_error on an argument it does not know.
+CompilerOptions parseCompilerOptions(const std::vector<std::string> &args, const std::string &cwd = "");
+
+#endif // MILA_COMPILEROPTIONS_HPP
@@ -0,0 +1,81 @@
+#include "DebugInfo.hpp"
+
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+
+namespace {
+
+llvm::DIFile *sourceFile(llvm::DIBuilder &builder, const std::string &sourcePath) {
+    llvm::SmallString<256> directory;
+    if (llvm::sys::path::is_absolute(sourcePath))
+        directory = llvm::sys::path::parent_path(sourcePath);
+    else
+        llvm::sys::fs::current_path(directory);
+    return builder.createFile(llvm::sys::path::filename(sourcePath), directory);
+}
+
+}
+
+DebugInfo::DebugInfo(llvm::Module &module, const std::string &sourcePath)
+    : m_Module(module), m_Builder(module)
+{
+    m_File = sourceFile(m_Builder, sourcePath);
+    // Mila has no language code of its own, Pascal is the closest one debuggers know
+    m_Unit = m_Builder.createCompileUnit(llvm::dwarf::DW_LANG_Pascal83, m_File, "mila", false, "", 0);
+    m_Integer = m_Builder.createBasicType("integer", 32, llvm::dwarf::DW_ATE_signed);
+    m_Real = m_Builder.createBasicType("real", 64, llvm::dwarf::DW_ATE_float);
+    module.addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+    module.addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+}
+
+void DebugInfo::beginFunction(llvm::IRBuilder<> &builder, llvm::Function &function, const Position &position) {
+    // The return type comes first, null for procedures
+    llvm::SmallVector<llvm::Metadata *, 8> types;
+    types.push_back(function.getReturnType()->isVoidTy() ? nullptr : typeOf(function.getReturnType()));
+    for (const llvm::Argument &arg : function.args())
+        types.push_back(typeOf(arg.getType()));
+    llvm::DISubroutineType *type = m_Builder.createSubroutineType(m_Builder.getOrCreateTypeArray(types));
+
+    m_Function = m_Builder.createFunction(m_File, function.getName(), "", m_File, position.getLine(), type,
+            position.getLine(), llvm::DINode::FlagPrototyped, llvm::DISubprogram::SPFlagDefinition);
+    function.setSubprogram(m_Function);
+    // Calls of other routines need a location even before the first statement
+    builder.SetCurrentDebugLocation(llvm::DILocation::get(function.getContext(), position.getLine(),
+            position.getColumn(), m_Function));
+}
+
+void DebugInfo::endFunction(llvm::IRBuilder<> &builder) {
+    m_Builder.finalizeSubprogram(m_Function);
+    m_Function = nullptr;
+    builder.SetCurrentDebugLocation(llvm::DebugLoc());
+}
+
+void DebugInfo::setLocation(llvm::IRBuilder<> &builder, const Position &position) {
+    if (!m_Function || position.getLine() == 0)
+        return;
+    builder.SetCurrentDebugLocation(llvm::DILocation::get(m_Module.getContext(), position.getLine(),
+            position.getColumn(), m_Function));
+}
+
+void DebugInfo::declareVariable(llvm::IRBuilder<> &builder, llvm::AllocaInst *slot, const std::string &name,
+                                const Position &position, unsigned argNo) {
+    if (!m_Function)
+        return;
+    unsigned line = position.getLine() ? position.getLine() : m_Function->getLine();
+    llvm::DILocalVariable *variable = argNo
+            ? m_Builder.createParameterVariable(m_Function, name, argNo, m_File, line, typeOf(slot->getAllocatedType()), true)
+            : m_Builder.createAutoVariable(m_Function, name, m_File, line, typeOf(slot->getAllocatedType()), true);
+    m_Builder.insertDeclare(slot, variable, m_Builder.createExpression(),
+            llvm::DILocation::get(m_Module.getContext(), line, position.getColumn(), m_Function),
+            builder.GetInsertBlock());
+}
+
+llvm::DIType *DebugInfo::typeOf(llvm::Type *type) const {
+    return type->isDoubleTy() ? m_Real : m_Integer;
+}
+
+void DebugInfo::finalize() {
+    m_Builder.finalize();
+}
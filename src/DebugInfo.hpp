@@ -0,0 +1,45 @@
+#ifndef MILA_DEBUGINFO_HPP
+#define MILA_DEBUGINFO_HPP
+
+#include <string>
+
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+
+#include "Position.hpp"
+
+/*
+ * DWARF for one module (-g): a compile unit for the source, a subprogram per routine, a variable per parameter,
+ * local and return value, and the line of the statement every instruction was generated for. Debug info is
+ * metadata and intrinsics the optimiser looks through, the code generated with -g is the same as without it.
+ */
+class DebugInfo {
+public:
+    DebugInfo(llvm::Module &module, const std::string &sourcePath);
+
+    // Subprogram of a routine declared at position, instructions generated from now on belong to it
+    void beginFunction(llvm::IRBuilder<> &builder, llvm::Function &function, const Position &position);
+    void endFunction(llvm::IRBuilder<> &builder);
+    // Instructions generated from now on belong to the statement at position, nothing changes for 0:0
+    void setLocation(llvm::IRBuilder<> &builder, const Position &position);
+    // Describes the stack slot of a variable of the current routine, argNo counts parameters from 1, 0 for locals
+    void declareVariable(llvm::IRBuilder<> &builder, llvm::AllocaInst *slot, const std::string &name,
+                         const Position &position, unsigned argNo = 0);
+    // Completes the module, no routine may be generated afterwards
+    void finalize();
+
+private:
+    llvm::DIType *typeOf(llvm::Type *type) const;
+
+    llvm::Module &m_Module;
+    llvm::DIBuilder m_Builder;
+    llvm::DIFile *m_File;
+    llvm::DICompileUnit *m_Unit;
+    llvm::DIBasicType *m_Integer;
+    llvm::DIBasicType *m_Real;
+    llvm::DISubprogram *m_Function = nullptr;
+};
+
+#endif // MILA_DEBUGINFO_HPP
@@ -0,0 +1,128 @@
+#include "FunctionEffects.hpp"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/Analysis/CFG.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+
+namespace {
+
+// Routines of fce.c, all of them do I/O, return and never unwind
+const std::set<std::string> RuntimeFunctions = {"writeln", "write", "readln", "writeln_real", "write_real", "readln_real",
+                                                "mila_parallel_lock", "mila_parallel_unlock"};
+
+struct FunctionInfo {
+    FunctionEffect effect = FunctionEffect::Pure;
+    bool recursive = false;
+    bool willReturn = true;
+};
+
+FunctionEffect instructionEffect(const llvm::Instruction &I) {
+    if (!I.mayReadOrWriteMemory())
+        return FunctionEffect::Pure;
+    // Stack slots of the routine itself are not visible from outside
+    const llvm::Value *Ptr = llvm::getLoadStorePointerOperand(&I);
+    if (Ptr && llvm::isa<llvm::AllocaInst>(llvm::getUnderlyingObject(Ptr)))
+        return FunctionEffect::Pure;
+    return I.mayWriteToMemory() ? FunctionEffect::IO : FunctionEffect::ReadOnly;
+}
+
+FunctionInfo declarationInfo(const llvm::Function &F) {
+    FunctionInfo info;
+    info.effect = FunctionEffect::IO;
+    info.willReturn = RuntimeFunctions.count(F.getName().str()) != 0;
+    return info;
+}
+
+void applyInfo(llvm::Function &F, const FunctionInfo &info, const std::set<std::string> &exported) {
+    if (F.isDeclaration()) {
+        if (RuntimeFunctions.count(F.getName().str())) {
+            F.addFnAttr(llvm::Attribute::NoUnwind);
+            F.addFnAttr(llvm::Attribute::WillReturn);
+        }
+        return;
+    }
+
+    if (!exported.count(F.getName().str()))
+        F.setLinkage(llvm::GlobalValue::InternalLinkage);
+    // Mila has no exceptions
+    F.addFnAttr(llvm::Attribute::NoUnwind);
+    if (info.effect == FunctionEffect::Pure)
+        F.addFnAttr(llvm::Attribute::ReadNone);
+    else if (info.effect == FunctionEffect::ReadOnly)
+        F.addFnAttr(llvm::Attribute::ReadOnly);
+    if (!info.recursive)
+        F.addFnAttr(llvm::Attribute::NoRecurse);
+    if (info.willReturn)
+        F.addFnAttr(llvm::Attribute::WillReturn);
+}
+
+}
+
+void annotateFunctionEffects(llvm::Module &module, const std::set<std::string> &exported) {
+    llvm::CallGraph CG(module);
+    std::map<const llvm::Function *, FunctionInfo> infos;
+
+    // SCCs come bottom-up, so everything called from outside the current SCC is already classified
+    for (auto SCCIt = llvm::scc_begin(&CG); !SCCIt.isAtEnd(); ++SCCIt) {
+        std::set<llvm::Function *> members;
+        for (llvm::CallGraphNode *Node : *SCCIt) {
+            if (Node->getFunction())
+                members.insert(Node->getFunction());
+        }
+        if (members.empty())
+            continue;
+
+        FunctionInfo info;
+        info.recursive = SCCIt.hasCycle();
+        info.willReturn = !info.recursive;
+        for (llvm::Function *F : members) {
+            if (F->isDeclaration()) {
+                info = declarationInfo(*F);
+                continue;
+            }
+
+            // Any loop may run forever
+            llvm::SmallVector<std::pair<const llvm::BasicBlock *, const llvm::BasicBlock *>, 4> BackEdges;
+            llvm::FindFunctionBackedges(*F, BackEdges);
+            if (!BackEdges.empty())
+                info.willReturn = false;
+
+            for (const llvm::BasicBlock &BB : *F) {
+                for (const llvm::Instruction &I : BB) {
+                    // Debug info (-g) describes the routine, it does nothing
+                    if (llvm::isa<llvm::DbgInfoIntrinsic>(I))
+                        continue;
+                    const auto *Call = llvm::dyn_cast<llvm::CallBase>(&I);
+                    if (!Call) {
+                        info.effect = std::max(info.effect, instructionEffect(I));
+                        continue;
+                    }
+                    llvm::Function *Callee = Call->getCalledFunction();
+                    if (Callee && members.count(Callee))
+                        continue;
+                    auto calleeIt = Callee ? infos.find(Callee) : infos.end();
+                    if (calleeIt == infos.end()) {
+                        info.effect = FunctionEffect::IO;
+                        info.willReturn = false;
+                        continue;
+                    }
+                    info.effect = std::max(info.effect, calleeIt->second.effect);
+                    info.willReturn = info.willReturn && calleeIt->second.willReturn;
+                }
+            }
+        }
+
+        for (llvm::Function *F : members) {
+            infos[F] = info;
+            applyInfo(*F, info, exported);
+        }
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef MILA_FUNCTIONEFFECTS_HPP
+#define MILA_FUNCTIONEFFECTS_HPP
+
+#include <set>
+#include <string>
+
+#include <llvm/IR/Module.h>
+
+/// What a routine may do to the world outside of its own stack frame.
+/// Ordered, the effect of a routine is the maximum over everything it does and calls.
+enum class FunctionEffect {
+    Pure,       // only touches its own locals
+    ReadOnly,   // may read memory it does not own
+    IO,         // performs I/O or writes memory it does not own
+};
+
+/**
+ * @brief Interprocedural effect analysis over the module call graph.
+ *
+ * Walks call graph SCCs bottom-up, classifies every defined routine as pure, read-only or I/O performing,
+ * finds recursive ones and attaches the matching LLVM attributes (readnone/readonly, nounwind, willreturn,
+ * norecurse). Every routine except the exported ones (main of a program, the interface of a unit) gets internal linkage.
+ */
+void annotateFunctionEffects(llvm::Module &module, const std::set<std::string> &exported);
+
+#endif // MILA_FUNCTIONEFFECTS_HPP
@@ -1,10 +1,20 @@
+#include<stdexcept>
 #include<string>
 
 #include "Lexer.hpp"
 #include "Token.hpp"
 #include <iostream>
+/// Reads the next character and moves the position past the one in lastChar
+int Lexer::nextChar() {
+    if (lastChar == '\n')
+        m_currentPos.line();
+    else
+        m_currentPos.advance();
+    return m_Input.get();
+}
+
 /**
- * @brief Function to return the next token from standard input
+ * @brief Function to return the next token from the input stream (standard input by default)
  *
  * the variable 'm_IdentifierStr' is set there in case of an identifier,
  * the variable 'm_NumVal' is set there in case of a number.
@@ -13,15 +23,16 @@
 int Lexer::gettok()
 {
     while(isspace(lastChar)) {
-        lastChar = std::cin.get();
+        lastChar = nextChar();
     }
+    m_tokenPos = m_currentPos;
 
     // Identifier
     if (isalpha(lastChar ) || lastChar == '_' ) { // identifier: [a-zA-Z_-][a-zA-Z0-9_-]*
         std::string identifierStr;
         identifierStr += lastChar;
 
-        while ( isalnum(lastChar = std::cin.get() ) || lastChar == '_' )
+        while ( isalnum(lastChar = nextChar() ) || lastChar == '_' )
             identifierStr += lastChar;
 
         // If identifier is a keyword
@@ -42,12 +53,43 @@ int Lexer::gettok()
         char numberBase = ' ';
         if(lastChar == '$' || lastChar =='&') {
             numberBase = lastChar;
-            lastChar = std::cin.get();
+            lastChar = nextChar();
         }
         do {
             numStr += lastChar;
-            lastChar = std::cin.get();
+            lastChar = nextChar();
         } while (isdigit(lastChar));
+        // Real number: digits ['.' digits] [('e' | 'E') ['+' | '-'] digits] with a fraction, an exponent or both,
+        // a '.' without a digit after it is left alone
+        bool real = false;
+        if (numberBase == ' ' && lastChar == '.' && isdigit(m_Input.peek())) {
+            do {
+                numStr += lastChar;
+                lastChar = nextChar();
+            } while (isdigit(lastChar));
+            real = true;
+        }
+        int afterE = m_Input.peek();
+        if (numberBase == ' ' && (lastChar == 'e' || lastChar == 'E')
+            && (real || isdigit(afterE) || afterE == '+' || afterE == '-')) {
+            numStr += lastChar;
+            lastChar = nextChar();
+            if (lastChar == '+' || lastChar == '-') {
+                numStr += lastChar;
+                lastChar = nextChar();
+            }
+            if (!isdigit(lastChar))
+                throw std::runtime_error("Missing exponent digits in real number " + numStr);
+            do {
+                numStr += lastChar;
+                lastChar = nextChar();
+            } while (isdigit(lastChar));
+            real = true;
+        }
+        if (real) {
+            m_RealVal = strtod(numStr.c_str(), nullptr);
+            return tok_real_number;
+        }
         if(numberBase == ' ') {
             m_NumVal = strtod(numStr.c_str(), 0);
         }
@@ -66,22 +108,38 @@ int Lexer::gettok()
     if (lastChar == '#') {
         // Comment until end of line.
         do
-            lastChar = std::cin.get();
+            lastChar = nextChar();
         while (lastChar != EOF && lastChar != '\n' && lastChar != '\r');
 
         if (lastChar != EOF)
             return gettok();
     }
 
+    // Comments in braces, {$name arguments} is a directive for the statement that follows
+    if (lastChar == '{') {
+        std::string text;
+        while ((lastChar = nextChar()) != '}') {
+            if (lastChar == EOF)
+                throw std::runtime_error("Unterminated comment in braces");
+            text += lastChar;
+        }
+        lastChar = nextChar();
+        if (!text.empty() && text[0] == '$') {
+            m_IdentifierStr = text.substr(1);
+            return tok_directive;
+        }
+        return gettok();
+    }
+
     // Handle strings
     if (lastChar == '\"') {
         std::string str;
-        while ((lastChar = std::cin.get()) != '\"') {
+        while ((lastChar = nextChar()) != '\"') {
             str += lastChar;
         }
         m_IdentifierStr = str;
         // Must be ended in "
-        lastChar = std::cin.get();
+        lastChar = nextChar();
         return TokenType::tok_identifier;
     }
 
@@ -91,12 +149,12 @@ int Lexer::gettok()
         std::string op;
         op += lastChar;
 //        std::clog << std::endl <<"lastChar: >" << static_cast<char>(lastChar) << "<" << std::endl;
-        lastChar = std::cin.get();
+        lastChar = nextChar();
 //        std::clog << "nextChar: >" << static_cast<char>(lastChar) << "<" << std::endl;
         // if matches m_2char_operators
         if(m_2char_operators.find( op + static_cast<char>(lastChar) ) != m_2char_operators.end()) {
             std::string returnValue(op + static_cast<char>(lastChar));
-            lastChar = std::cin.get();
+            lastChar = nextChar();
             return m_2char_operators[returnValue];
         }
         return m_1char_operators[op[0]];
@@ -104,11 +162,11 @@ int Lexer::gettok()
     
 
     // Check for end of file.  Don't eat the EOF.
-    if (std::cin.peek() == EOF)
+    if (m_Input.peek() == EOF)
         return tok_eof;
 
     // Otherwise, just return the character as its ascii value.
-    return static_cast<int>(std::cin.get());
+    return static_cast<int>(nextChar());
 }
 
 
@@ -7,6 +7,7 @@
 #include <optional>
 #include <map>
 
+#include "Position.hpp"
 #include "Token.hpp"
 
 
@@ -58,6 +59,22 @@ enum TokenType {
     tok_array =         -32,
     tok_break =         -34,
 
+    // keywords for units
+    tok_unit =          -35,
+    tok_uses =          -36,
+    tok_interface =     -37,
+    tok_implementation = -38,
+
+    // real numbers
+    tok_real =          -39,
+    tok_real_number =   -40,
+
+    // {$...} compiler directive, its text is in identifierStr
+    tok_directive =     -41,
+
+    // parallel for
+    tok_parallel =      -42,
+
     // 1-character operators
     tok_plus =          '+',
     tok_minus =         '-',
@@ -89,7 +106,8 @@ enum TokenType {
 
 class Lexer {
 public:
-    Lexer() {
+    Lexer() : Lexer(std::cin) {}
+    explicit Lexer(std::istream &input) : m_Input(input), m_currentPos(1, 0) {
         lastChar = ' ';
         initialize_keywords();
         initialize_2char_operators();
@@ -103,13 +121,21 @@ public:
     const std::string& identifierStr() const { return this->m_IdentifierStr; }
 
     int numVal() { return this->m_NumVal; }
+    double realVal() const { return m_RealVal; }
+    // Where the token gettok returned last starts
+    const Position& tokenPosition() const { return m_tokenPos; }
 
 private:
+    std::istream &m_Input;
     int lastChar;
     std::string m_IdentifierStr;
     int m_NumVal;
+    double m_RealVal = 0;
+
+    Position m_currentPos;           // of lastChar
+    Position m_tokenPos;
 
-    // Position m_currentPos;
+    int nextChar();
     std::vector<TokenType> m_Tokens;
     
     std::map<std::string, TokenType> m_keywords;
@@ -129,12 +155,18 @@ private:
         m_keywords["exit"] = tok_exit;
         m_keywords["var"] = tok_var;
         m_keywords["integer"] = tok_integer;
+        m_keywords["real"] = tok_real;
         m_keywords["for"] = tok_for;
         m_keywords["to"] = tok_to;
         m_keywords["downto"] = tok_downto;
         m_keywords["do"] = tok_do;
         m_keywords["or"] = tok_or;
         m_keywords["break"] = tok_break;
+        m_keywords["unit"] = tok_unit;
+        m_keywords["uses"] = tok_uses;
+        m_keywords["interface"] = tok_interface;
+        m_keywords["implementation"] = tok_implementation;
+        m_keywords["parallel"] = tok_parallel;
 
     }
 
@@ -0,0 +1,211 @@
+#include "MemoryReport.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <malloc.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <typeinfo>
+
+#include <sys/resource.h>
+
+#include "AST.hpp"
+
+namespace {
+
+struct Phase {
+    std::atomic<const char *> name{nullptr};
+    std::atomic<std::uint64_t> allocations{0}, allocatedBytes{0}, frees{0}, freedBytes{0};
+    // Growth of the peak RSS while the phase was the outermost one, in KiB
+    std::atomic<long> rssGrowth{0};
+};
+
+// Slot 0 takes everything outside of a phase. A fixed table, the hooks must not allocate.
+const int MaxPhases = 32;
+Phase g_Phases[MaxPhases];
+std::atomic<int> g_PhaseCount{1};
+std::mutex g_PhaseMutex;
+std::atomic<bool> g_Enabled{false};
+
+thread_local int t_Phase = 0;
+thread_local long t_RssAtEntry = 0;
+
+std::mutex g_AstMutex;
+std::map<std::string, std::uint64_t> g_AstNodes;
+
+long peakRss() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Both sides count the usable size of the block, a free does not know the size that was asked for
+void countAllocation(void *pointer) {
+    if (!pointer || !g_Enabled.load(std::memory_order_relaxed))
+        return;
+    Phase &phase = g_Phases[t_Phase];
+    phase.allocations.fetch_add(1, std::memory_order_relaxed);
+    phase.allocatedBytes.fetch_add(malloc_usable_size(pointer), std::memory_order_relaxed);
+}
+
+void countFree(void *pointer) {
+    if (!pointer || !g_Enabled.load(std::memory_order_relaxed))
+        return;
+    Phase &phase = g_Phases[t_Phase];
+    phase.frees.fetch_add(1, std::memory_order_relaxed);
+    phase.freedBytes.fetch_add(malloc_usable_size(pointer), std::memory_order_relaxed);
+}
+
+void *allocate(std::size_t size, bool nothrow) {
+    void *pointer = std::malloc(size ? size : 1);
+    if (!pointer && !nothrow)
+        throw std::bad_alloc();
+    countAllocation(pointer);
+    return pointer;
+}
+
+void *allocateAligned(std::size_t size, std::align_val_t alignment, bool nothrow) {
+    void *pointer = nullptr;
+    std::size_t align = std::max(static_cast<std::size_t>(alignment), sizeof(void *));
+    if (posix_memalign(&pointer, align, size ? size : 1) != 0)
+        pointer = nullptr;
+    if (!pointer && !nothrow)
+        throw std::bad_alloc();
+    countAllocation(pointer);
+    return pointer;
+}
+
+void release(void *pointer) {
+    countFree(pointer);
+    std::free(pointer);
+}
+
+std::string kindName(const AST &node) {
+    const char *mangled = typeid(node).name();
+    int status = 0;
+    std::unique_ptr<char, void (*)(void *)> name(abi::__cxa_demangle(mangled, nullptr, nullptr, &status), std::free);
+    return status == 0 && name ? name.get() : mangled;
+}
+
+void countNodes(const AST &node, std::map<std::string, std::uint64_t> &counts) {
+    counts[kindName(node)]++;
+    node.forEachChild([&counts](const AST &child) { countNodes(child, counts); });
+}
+
+}
+
+void *operator new(std::size_t size) { return allocate(size, false); }
+void *operator new[](std::size_t size) { return allocate(size, false); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return allocate(size, true); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return allocate(size, true); }
+void *operator new(std::size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment, false); }
+void *operator new[](std::size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment, false); }
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return allocateAligned(size, alignment, true);
+}
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return allocateAligned(size, alignment, true);
+}
+
+void operator delete(void *pointer) noexcept { release(pointer); }
+void operator delete[](void *pointer) noexcept { release(pointer); }
+void operator delete(void *pointer, std::size_t) noexcept { release(pointer); }
+void operator delete[](void *pointer, std::size_t) noexcept { release(pointer); }
+void operator delete(void *pointer, const std::nothrow_t &) noexcept { release(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept { release(pointer); }
+void operator delete(void *pointer, std::align_val_t) noexcept { release(pointer); }
+void operator delete[](void *pointer, std::align_val_t) noexcept { release(pointer); }
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept { release(pointer); }
+void operator delete[](void *pointer, std::size_t, std::align_val_t) noexcept { release(pointer); }
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t &) noexcept { release(pointer); }
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t &) noexcept { release(pointer); }
+
+void MemoryReport::enable() {
+    g_Phases[0].name = "other";
+    g_Enabled = true;
+}
+
+bool MemoryReport::enabled() {
+    return g_Enabled.load(std::memory_order_relaxed);
+}
+
+int MemoryReport::enterPhase(const char *phase) {
+    int slot = 0;
+    for (int i = 1; i < g_PhaseCount.load(std::memory_order_acquire) && !slot; i++) {
+        if (std::strcmp(g_Phases[i].name.load(std::memory_order_relaxed), phase) == 0)
+            slot = i;
+    }
+    if (!slot) {
+        std::lock_guard<std::mutex> lock(g_PhaseMutex);
+        int count = g_PhaseCount.load();
+        for (int i = 1; i < count && !slot; i++) {
+            if (std::strcmp(g_Phases[i].name.load(), phase) == 0)
+                slot = i;
+        }
+        if (!slot && count < MaxPhases) {
+            g_Phases[count].name = phase;
+            g_PhaseCount.store(count + 1, std::memory_order_release);
+            slot = count;
+        }
+    }
+
+    int outer = t_Phase;
+    if (outer == 0)
+        t_RssAtEntry = peakRss();
+    t_Phase = slot;
+    return outer;
+}
+
+void MemoryReport::leavePhase(int outer) {
+    if (outer == 0)
+        g_Phases[t_Phase].rssGrowth.fetch_add(peakRss() - t_RssAtEntry, std::memory_order_relaxed);
+    t_Phase = outer;
+}
+
+void MemoryReport::countAst(const AST &root) {
+    std::map<std::string, std::uint64_t> counts;
+    countNodes(root, counts);
+    std::lock_guard<std::mutex> lock(g_AstMutex);
+    for (const auto &count : counts)
+        g_AstNodes[count.first] += count.second;
+}
+
+void MemoryReport::print(std::ostream &out) {
+    char line[160];
+    out << "===--- Memory ---===\n";
+    std::snprintf(line, sizeof(line), "peak RSS: %ld KiB\n", peakRss());
+    out << line;
+    std::snprintf(line, sizeof(line), "%12s %12s %12s %12s %12s  %s\n", "allocations", "alloc KiB", "frees",
+                  "freed KiB", "RSS +KiB", "phase");
+    out << line;
+    for (int i = 0; i < g_PhaseCount.load(); i++) {
+        const Phase &phase = g_Phases[i];
+        std::snprintf(line, sizeof(line), "%12llu %12.1f %12llu %12.1f %12ld  ",
+                      static_cast<unsigned long long>(phase.allocations.load()), phase.allocatedBytes.load() / 1024.0,
+                      static_cast<unsigned long long>(phase.frees.load()), phase.freedBytes.load() / 1024.0,
+                      phase.rssGrowth.load());
+        out << line << phase.name.load() << "\n";
+    }
+
+    std::lock_guard<std::mutex> lock(g_AstMutex);
+    if (!g_AstNodes.empty()) {
+        out << "\n===--- AST nodes ---===\n";
+        std::uint64_t total = 0;
+        for (const auto &count : g_AstNodes) {
+            std::snprintf(line, sizeof(line), "%12llu  ", static_cast<unsigned long long>(count.second));
+            out << line << count.first << "\n";
+            total += count.second;
+        }
+        std::snprintf(line, sizeof(line), "%12llu  ", static_cast<unsigned long long>(total));
+        out << line << "total\n";
+    }
+    out.flush();
+}
@@ -0,0 +1,31 @@
+#ifndef MILA_MEMORYREPORT_HPP
+#define MILA_MEMORYREPORT_HPP
+
+#include <ostream>
+
+class AST;
+
+/**
+ * @brief Where the compiler's memory goes, for --mem-report.
+ *
+ * The global operator new and delete are replaced by counting ones, so every C++ allocation of the compiler and
+ * of LLVM is attributed to the phase the allocating thread is in; phases are the TimeReport scopes. LLVM's own
+ * malloc calls (SmallVector, DenseMap) are not seen by the hook, the peak RSS covers them. Routine bodies generated
+ * on worker threads (-j) count as "other". Counting costs one relaxed load per allocation while disabled.
+ */
+class MemoryReport {
+public:
+    static void enable();
+    static bool enabled();
+
+    /// Allocations of the calling thread count towards phase until leavePhase(returned value)
+    static int enterPhase(const char *phase);
+    static void leavePhase(int outer);
+
+    /// Adds the nodes of the tree, by kind
+    static void countAst(const AST &root);
+
+    static void print(std::ostream &out);
+};
+
+#endif // MILA_MEMORYREPORT_HPP
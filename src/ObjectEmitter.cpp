@@ -0,0 +1,72 @@
+#include "ObjectEmitter.hpp"
+
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+
+std::unique_ptr<llvm::TargetMachine> createHostTargetMachine(llvm::Module &module) {
+    static std::once_flag initialized;
+    std::call_once(initialized, [] {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+    });
+
+    std::string triple = llvm::sys::getDefaultTargetTriple();
+    std::string error;
+    const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, error);
+    if (!target) {
+        throw std::runtime_error("No target for " + triple + ": " + error);
+    }
+    std::unique_ptr<llvm::TargetMachine> machine(
+            target->createTargetMachine(triple, "generic", "", llvm::TargetOptions(), llvm::Reloc::PIC_));
+    module.setTargetTriple(triple);
+    module.setDataLayout(machine->createDataLayout());
+    return machine;
+}
+
+namespace {
+
+void emitObject(llvm::Module &module, llvm::raw_pwrite_stream &out) {
+    std::unique_ptr<llvm::TargetMachine> machine = createHostTargetMachine(module);
+
+    llvm::legacy::PassManager passes;
+    if (machine->addPassesToEmitFile(passes, out, nullptr, llvm::CGFT_ObjectFile)) {
+        throw std::runtime_error("The target cannot emit object files");
+    }
+    passes.run(module);
+}
+
+}
+
+void emitObject(llvm::Module &module, const std::string &path) {
+    llvm::Expected<llvm::sys::fs::TempFile> temp = llvm::sys::fs::TempFile::create(path + "-%%%%%%.tmp");
+    if (!temp) {
+        throw std::runtime_error("Cannot create " + path + ": " + llvm::toString(temp.takeError()));
+    }
+    try {
+        llvm::raw_fd_ostream out(temp->FD, false);
+        emitObject(module, out);
+    } catch (...) {
+        llvm::consumeError(temp->discard());
+        throw;
+    }
+    if (llvm::Error kept = temp->keep(path)) {
+        throw std::runtime_error("Cannot write " + path + ": " + llvm::toString(std::move(kept)));
+    }
+}
+
+void emitObject(llvm::Module &module, llvm::SmallVectorImpl<char> &object) {
+    object.clear();
+    llvm::raw_svector_ostream out(object);
+    emitObject(module, out);
+}
@@ -0,0 +1,24 @@
+#ifndef MILA_OBJECTEMITTER_HPP
+#define MILA_OBJECTEMITTER_HPP
+
+#include <memory>
+#include <string>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+/// The host target objects are emitted for, generic CPU and PIC. Sets the triple and data layout of module.
+std::unique_ptr<llvm::TargetMachine> createHostTargetMachine(llvm::Module &module);
+
+/**
+ * @brief Compiles the module into a native object file for the host, like llc -filetype=obj -relocation-model=pic.
+ *
+ * The object is written to a temporary file first and renamed, so concurrent builds sharing a directory
+ * never see a partially written object.
+ */
+void emitObject(llvm::Module &module, const std::string &path);
+/// Same object, kept in memory (for the JIT of mila --test-dir)
+void emitObject(llvm::Module &module, llvm::SmallVectorImpl<char> &object);
+
+#endif // MILA_OBJECTEMITTER_HPP
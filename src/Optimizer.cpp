@@ -0,0 +1,160 @@
+#include "Optimizer.hpp"
+
+#include <iostream>
+#include <string>
+
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/DiagnosticHandler.h>
+#include <llvm/IR/DiagnosticInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/Passes/PassBuilder.h>
+
+#include "ObjectEmitter.hpp"
+
+namespace {
+
+/// Times the passes through the pass manager's instrumentation, like -time-passes
+class PassTimer {
+public:
+    PassTimer(TimeReport &report, llvm::PassInstrumentationCallbacks &callbacks) : m_Report(report) {
+        callbacks.registerBeforeNonSkippedPassCallback([this](llvm::StringRef pass, llvm::Any) { start(pass); });
+        callbacks.registerAfterPassCallback(
+            [this](llvm::StringRef pass, llvm::Any, const llvm::PreservedAnalyses &) { stop(pass); });
+        callbacks.registerAfterPassInvalidatedCallback(
+            [this](llvm::StringRef pass, const llvm::PreservedAnalyses &) { stop(pass); });
+    }
+
+private:
+    struct Running {
+        double wall, cpu;
+        double innerWall = 0, innerCpu = 0;
+    };
+
+    // Pass managers and adaptors only run other passes, their time is the time of those
+    static bool isContainer(llvm::StringRef pass) {
+        return llvm::isSpecialPass(pass, {"PassManager", "PassAdaptor", "AnalysisManagerProxy", "DevirtSCCRepeatedPass",
+                                          "ModuleInlinerWrapperPass"});
+    }
+
+    void start(llvm::StringRef pass) {
+        if (!isContainer(pass))
+            m_Running.push_back({TimeReport::wallTime(), TimeReport::cpuTime()});
+    }
+
+    void stop(llvm::StringRef pass) {
+        if (isContainer(pass) || m_Running.empty())
+            return;
+        Running running = m_Running.back();
+        m_Running.pop_back();
+        double wall = TimeReport::wallTime() - running.wall;
+        double cpu = TimeReport::cpuTime() - running.cpu;
+        if (!m_Running.empty()) {
+            m_Running.back().innerWall += wall;
+            m_Running.back().innerCpu += cpu;
+        }
+        m_Report.addPass(pass.str(), wall - running.innerWall, cpu - running.innerCpu);
+    }
+
+    TimeReport &m_Report;
+    std::vector<Running> m_Running;
+};
+
+/// Warns about loop transformations a {$...} directive asked for that LLVM could not do, and passes on the remarks
+/// saying why, both to the given stream; other diagnostics are printed as usual
+class LoopDirectiveWarnings : public llvm::DiagnosticHandler {
+public:
+    explicit LoopDirectiveWarnings(std::ostream &out) : m_Out(out) {}
+
+    bool handleDiagnostics(const llvm::DiagnosticInfo &info) override {
+        // Only remarks that are enabled get here, those of forced transformations always are
+        const auto *diagnostic = llvm::dyn_cast<llvm::DiagnosticInfoIROptimization>(&info);
+        if (!diagnostic)
+            return false;
+        unsigned line = directiveLine(diagnostic->getCodeRegion());
+        if (!line && diagnostic->isLocationAvailable())
+            line = diagnostic->getLocation().getLine();
+        std::string message = info.getKind() == llvm::DK_OptimizationFailure ? "Warning: " : "Remark: ";
+        message += diagnostic->getFunction().getName().str();
+        if (line)
+            message += ", loop at line " + std::to_string(line);
+        message += ": " + diagnostic->getMsg() + "\n";
+        m_Out << message;
+        return true;
+    }
+
+private:
+    std::ostream &m_Out;
+
+    // mila.loop.line of the innermost loop around the block that has one, 0 without
+    static unsigned directiveLine(const llvm::Value *region) {
+        const auto *block = llvm::dyn_cast_or_null<llvm::BasicBlock>(region);
+        if (!block)
+            return 0;
+        llvm::DominatorTree tree(const_cast<llvm::Function &>(*block->getParent()));
+        llvm::LoopInfo loops(tree);
+        for (llvm::Loop *loop = loops.getLoopFor(block); loop; loop = loop->getParentLoop()) {
+            llvm::MDNode *id = loop->getLoopID();
+            llvm::MDNode *line = id ? llvm::findOptionMDForLoopID(id, "mila.loop.line") : nullptr;
+            if (line && line->getNumOperands() == 2)
+                return llvm::mdconst::extract<llvm::ConstantInt>(line->getOperand(1))->getZExtValue();
+        }
+        return 0;
+    }
+};
+
+// Routines with loops that carry {$...} directives, separated by ", ", only loops with directives get a loop id
+std::string routinesWithDirectives(const llvm::Module &module) {
+    std::string names;
+    for (const llvm::Function &function : module) {
+        for (const llvm::BasicBlock &block : function) {
+            const llvm::Instruction *terminator = block.getTerminator();
+            if (terminator && terminator->getMetadata(llvm::LLVMContext::MD_loop)) {
+                names += (names.empty() ? "" : ", ") + function.getName().str();
+                break;
+            }
+        }
+    }
+    return names;
+}
+
+}
+
+void optimizeModule(llvm::Module &module, unsigned level, TimeReport *report, std::ostream &diagnostics) {
+    if (level == 0) {
+        std::string names = routinesWithDirectives(module);
+        if (!names.empty())
+            diagnostics << "Warning: " << names << ": loop directives are only followed with -O1 or higher\n";
+        return;
+    }
+    TimeReport::Scope scope(report, "optimisation");
+    module.getContext().setDiagnosticHandler(std::make_unique<LoopDirectiveWarnings>(diagnostics));
+
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+
+    llvm::PassInstrumentationCallbacks callbacks;
+    std::unique_ptr<PassTimer> timer;
+    if (report)
+        timer = std::make_unique<PassTimer>(*report, callbacks);
+
+    llvm::PipelineTuningOptions tuning;
+    // With a profile (--profile-use) this would emit .cg_profile, which only lld uses and GNU as rejects
+    tuning.CallGraphProfile = false;
+    // The target's cost model, without it the vectorisers see no vector registers
+    std::unique_ptr<llvm::TargetMachine> machine = createHostTargetMachine(module);
+    llvm::PassBuilder PB(machine.get(), tuning, llvm::None, &callbacks);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    llvm::OptimizationLevel optLevel = level == 1 ? llvm::OptimizationLevel::O1
+                                     : level == 2 ? llvm::OptimizationLevel::O2
+                                     : llvm::OptimizationLevel::O3;
+    llvm::ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(optLevel);
+    MPM.run(module, MAM);
+}
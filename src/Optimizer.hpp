@@ -0,0 +1,20 @@
+#ifndef MILA_OPTIMIZER_HPP
+#define MILA_OPTIMIZER_HPP
+
+#include <iostream>
+
+#include <llvm/IR/Module.h>
+
+#include "TimeReport.hpp"
+
+/**
+ * @brief Runs LLVM's default module pipeline for the given level (0-3), 0 leaves the module untouched.
+ *
+ * With a report every pass is timed into it, nested passes are not counted again in the pass running them.
+ * Loop directives ({$vectorize} ...) that could not be followed are reported to diagnostics as warnings, as are
+ * directives at level 0, where nothing follows them.
+ */
+void optimizeModule(llvm::Module &module, unsigned level, TimeReport *report = nullptr,
+                    std::ostream &diagnostics = std::cerr);
+
+#endif // MILA_OPTIMIZER_HPP
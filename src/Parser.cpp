@@ -1,10 +1,196 @@
 #include "Parser.hpp"
+#include "DebugInfo.hpp"
+#include "FunctionEffects.hpp"
+#include "MemoryReport.hpp"
+#include "ObjectEmitter.hpp"
+#include "Optimizer.hpp"
+#include "Profile.hpp"
+#include "Runtime.hpp"
+#include "TimeReport.hpp"
+#include "UnitInterface.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/SHA1.h>
+
+namespace {
+
+/**
+ * Every function numbers the clashing names of its values with a counter that only grows. Bodies generated in
+ * parallel arrive with their final names and a fresh counter, so later passes would number new values differently
+ * than in a sequentially generated module. Moving each body into a new function resets the counter in both modes.
+ */
+void resetNameCounters(llvm::Module &module) {
+    std::vector<llvm::Function *> defined;
+    for (llvm::Function &F : module) {
+        if (!F.isDeclaration())
+            defined.push_back(&F);
+    }
+    for (llvm::Function *F : defined) {
+        llvm::Function *NF = llvm::Function::Create(F->getFunctionType(), F->getLinkage(), "");
+        module.getFunctionList().insert(F->getIterator(), NF);
+        NF->copyAttributesFrom(F);
+        // The subprogram of -g
+        NF->copyMetadata(F, 0);
+        NF->getBasicBlockList().splice(NF->begin(), F->getBasicBlockList());
+        auto newArg = NF->arg_begin();
+        for (llvm::Argument &arg : F->args()) {
+            arg.replaceAllUsesWith(&*newArg);
+            newArg->takeName(&arg);
+            ++newArg;
+        }
+        F->replaceAllUsesWith(NF);
+        NF->takeName(F);
+        F->eraseFromParent();
+    }
+}
+
+// The parsing routines give up on a syntax error by returning nullptr, the statement around it fails the parse
+[[noreturn]] void statementError(const Position &position) {
+    std::ostringstream message;
+    message << "Syntax error in the statement at " << position;
+    throw std::runtime_error(message.str());
+}
+
+// A vectorisation width or interleave count, LLVM ignores anything but a power of two up to 64
+unsigned directiveFactor(const std::string &text, const std::string &directive) {
+    size_t end = 0;
+    unsigned long value = 0;
+    try {
+        value = std::stoul(text, &end);
+    } catch (const std::exception &) {
+        end = 0;
+    }
+    if (end == 0 || end != text.size() || value == 0 || value > 64 || (value & (value - 1)) != 0)
+        throw std::runtime_error("{$" + directive + "} needs a power of two up to 64, got: " + text);
+    return static_cast<unsigned>(value);
+}
+
+// vectorize [width=N] | novectorize | interleave N | unroll [N] | nounroll
+void applyDirective(const std::string &directive, LoopDirectives &directives) {
+    std::istringstream words(directive);
+    std::string name, argument, extra;
+    words >> name >> argument >> extra;
+    if (!extra.empty())
+        throw std::runtime_error("Too many arguments in {$" + directive + "}");
+
+    if (name == "vectorize") {
+        directives.vectorize = true;
+        if (argument.compare(0, 6, "width=") == 0)
+            directives.vectorizeWidth = directiveFactor(argument.substr(6), directive);
+        else if (!argument.empty())
+            throw std::runtime_error("Unknown argument of {$" + directive + "}, expected width=N");
+    } else if (name == "novectorize" && argument.empty()) {
+        directives.vectorize = false;
+        directives.vectorizeWidth = 0;
+    } else if (name == "interleave") {
+        directives.interleaveCount = directiveFactor(argument, directive);
+    } else if (name == "unroll") {
+        directives.unroll = true;
+        directives.unrollCount = 0;
+        if (!argument.empty()) {
+            size_t end = 0;
+            int count = 0;
+            try {
+                count = std::stoi(argument, &end);
+            } catch (const std::exception &) {
+                end = 0;
+            }
+            if (end == 0 || end != argument.size() || count <= 0)
+                throw std::runtime_error("{$unroll} needs a positive count, got: " + argument);
+            directives.unrollCount = static_cast<unsigned>(count);
+        }
+    } else if (name == "nounroll" && argument.empty()) {
+        directives.unroll = false;
+    } else {
+        throw std::runtime_error("Unknown directive {$" + directive + "}");
+    }
+}
+
+}
 
 Parser::Parser()
     : gen("mila")
 {
 }
 
+Parser::Parser(std::istream &input)
+    : m_Lexer(input), gen("mila")
+{
+}
+
+void Parser::addInterfaceDir(const std::string &dir) {
+    m_InterfaceDirs.push_back(dir);
+}
+
+void Parser::setInterfaceFile(const std::string &path) {
+    m_InterfaceFile = path;
+}
+
+void Parser::setTimeReport(TimeReport *report) {
+    m_TimeReport = report;
+    gen.timeReport = report;
+}
+
+void Parser::setDiagnostics(std::ostream &out) {
+    m_Diagnostics = &out;
+}
+
+void Parser::setJobs(unsigned jobs) {
+    m_Jobs = jobs;
+}
+
+void Parser::setLinkRuntime(bool link) {
+    m_LinkRuntime = link;
+}
+
+void Parser::setProfileGenerate(const std::string &path) {
+    m_ProfileGenerate = path;
+}
+
+void Parser::setProfileUse(const std::string &path) {
+    m_ProfileUse = path;
+}
+
+void Parser::setSourceProfile(bool profile) {
+    gen.sourceProfile = profile;
+}
+
+void Parser::setDebugInfo(const std::string &sourcePath) {
+    m_DebugSource = sourcePath;
+}
+
+void Parser::setFastMath(bool fastMath) {
+    gen.fastMath = fastMath;
+}
+
+void Parser::setOptions(const CompilerOptions &options) {
+    for (const std::string &dir : options.interfaceDirs)
+        addInterfaceDir(dir);
+    if (!options.interfaceFile.empty())
+        setInterfaceFile(options.interfaceFile);
+    setJobs(std::max(1u, options.jobs));
+    setProfileGenerate(options.profileGenerate);
+    setProfileUse(options.profileUse);
+    setSourceProfile(options.sourceProfile);
+    setFastMath(options.fastMath);
+    // The source comes from stdin, --source-name tells the debugger which file it was
+    if (options.debugInfo)
+        setDebugInfo(options.sourceName);
+}
+
 void Parser::printCurrentToken() {
     std::map<int, std::string> tokenMap = {
             {-1, "tok_eof"},
@@ -40,6 +226,14 @@ void Parser::printCurrentToken() {
             {-31, "tok_downto"},
             {-32, "tok_array"},
             {-33, "tok_range"},
+            {-35, "tok_unit"},
+            {-36, "tok_uses"},
+            {-37, "tok_interface"},
+            {-38, "tok_implementation"},
+            {-39, "tok_real"},
+            {-40, "tok_real_number"},
+            {-41, "tok_directive"},
+            {-42, "tok_parallel"},
             {'+', "+"},
             {'-', "-"},
             {'*', "*"},
@@ -73,20 +267,37 @@ void Parser::printCurrentToken() {
     else if(CurTok == TokenType::tok_number) {
         std::clog << "\'" << m_Lexer.numVal() << "\'" << ", ";
     }
+    else if(CurTok == TokenType::tok_real_number) {
+        std::clog << "\'" << m_Lexer.realVal() << "\'" << ", ";
+    }
     else
         std::clog << "\'" << tokenMap[CurTok]  << "\'" << ", ";
 }
 
 bool Parser::Parse()
 {
-    getNextToken();
-    consume(TokenType::tok_program);
-    consume(TokenType::tok_identifier);
-    consume(TokenType::tok_semicolon);
-    // Main logic
-    auto result = ParseModule();
-    m_AstTree = std::move(result);
-    consume(TokenType::tok_dot);
+    {
+        TimeReport::Scope scope(m_TimeReport, "parse");
+        getNextToken();
+        if (CurTok == TokenType::tok_unit) {
+            m_AstTree = ParseUnit();
+        } else {
+            consume(TokenType::tok_program);
+            consume(TokenType::tok_identifier);
+            consume(TokenType::tok_semicolon);
+            ParseUses();
+            // Main logic
+            auto result = ParseModule();
+            m_AstTree = std::move(result);
+            consume(TokenType::tok_dot);
+        }
+    }
+    if (m_TimeReport) {
+        m_TimeReport->addCount("tokens", m_TokenCount);
+        m_TimeReport->addCount("AST nodes", m_AstTree->countNodes());
+    }
+    if (MemoryReport::enabled())
+        MemoryReport::countAst(*m_AstTree);
     return true;
 }
 
@@ -111,13 +322,90 @@ std::unique_ptr<AST> Parser::ParseModule() {
     return nullptr;
 }
 
+/// uses ::= 'uses' identifier (',' identifier)* ';'
+void Parser::ParseUses() {
+    if (CurTok != tok_uses)
+        return;
+    consume(tok_uses);
+    while (true) {
+        if (CurTok != tok_identifier)
+            throw std::runtime_error("Expected unit name in uses, got: " + ReturnTokenString(CurTok));
+        m_Uses.push_back(m_Lexer.identifierStr());
+        consume(tok_identifier);
+        if (CurTok != tok_comma)
+            break;
+        consume(tok_comma);
+    }
+    consume(tok_semicolon);
+}
+
+/// unit ::= 'unit' identifier ';' 'interface' uses? (const | prototype)* 'implementation' function* 'end' '.'
+///
+/// Constants and routines of the interface section are exported, routines only defined
+/// in the implementation section are private to the unit.
+std::unique_ptr<AST> Parser::ParseUnit() {
+    consume(tok_unit);
+    m_UnitName = m_Lexer.identifierStr();
+    consume(tok_identifier);
+    consume(tok_semicolon);
+    consume(tok_interface);
+    ParseUses();
+
+    std::vector<std::unique_ptr<AST>> routines;
+    while (CurTok != tok_implementation) {
+        switch (CurTok) {
+            case tok_const:
+                ParseFunctionVarDeclaration(m_UnitConstants);
+                for (const auto &constant : m_UnitConstants) {
+                    if (!constant->isConstant())
+                        throw std::runtime_error("Units cannot export variables: " + constant->getName());
+                }
+                break;
+            case tok_procedure:
+            case tok_function: {
+                std::unique_ptr<PrototypeAST> prototype = ParsePrototype();
+                m_Exports.push_back(prototype->getName());
+                routines.push_back(std::make_unique<FunctionAST>(std::move(prototype),
+                                                                 std::vector<std::unique_ptr<VarDeclAST>>(), nullptr));
+                break;
+            }
+            case tok_semicolon:
+                consume(tok_semicolon);
+                break;
+            default:
+                throw std::runtime_error("Unexpected token in unit interface: " + ReturnTokenString(CurTok));
+        }
+    }
+    consume(tok_implementation);
+
+    while (CurTok != tok_end) {
+        switch (CurTok) {
+            case tok_procedure:
+            case tok_function:
+                routines.push_back(ParseFunction());
+                break;
+            case tok_semicolon:
+                consume(tok_semicolon);
+                break;
+            default:
+                throw std::runtime_error("Unexpected token in unit implementation: " + ReturnTokenString(CurTok));
+        }
+    }
+    consume(tok_end);
+    consume(tok_dot);
+    return std::make_unique<BlockAST>(std::move(routines));
+}
+
 std::unique_ptr<AST> Parser::ParseMainModule() {
+    Position position = m_Lexer.tokenPosition();
     std::unique_ptr<PrototypeAST> prototype = std::make_unique<PrototypeAST>("main", std::vector<std::string>(), nullptr);
     std::vector<std::unique_ptr<VarDeclAST>> vars;
     ParseFunctionVarDeclaration(vars);
 
     std::unique_ptr<AST> body = ParseBlock();
-    return std::make_unique<FunctionAST>(std::move(prototype), std::move(vars), std::move(body));
+    auto function = std::make_unique<FunctionAST>(std::move(prototype), std::move(vars), std::move(body));
+    function->setPosition(position);
+    return function;
 }
 
 // Begin
@@ -131,15 +419,15 @@ std::unique_ptr<PrototypeAST> Parser::ParsePrototype()
     std::string idName = m_Lexer.identifierStr();
     std::unique_ptr<VarDeclAST> returnValue = nullptr;
     consume(tok_identifier);
-//    #TODO take in more than integer
     consume('(');
     std::vector<std::string> parameters;
+    std::vector<TypeAST::Type> parameterTypes;
     while (CurTok != ')')
     {
         parameters.push_back(m_Lexer.identifierStr());
         consume(tok_identifier);
         consume(':');
-        consume(tok_integer);
+        parameterTypes.push_back(ParseType());
         if(CurTok == ')') break;
         consume(';');
 
@@ -149,21 +437,33 @@ std::unique_ptr<PrototypeAST> Parser::ParsePrototype()
     if (tokenType == tok_function)
     {
         consume(':');
-        consume(tok_integer);
+        TypeAST::Type returnType = ParseType();
         consume(';');
-        returnValue = std::make_unique<VarDeclAST>(idName, std::make_unique<TypeAST>(TypeAST::Type::INT), nullptr, false);
-        return std::make_unique<PrototypeAST>(idName, std::move(parameters), std::move(returnValue));
+        returnValue = std::make_unique<VarDeclAST>(idName, std::make_unique<TypeAST>(returnType), nullptr, false);
+        return std::make_unique<PrototypeAST>(idName, std::move(parameters), std::move(returnValue),
+                                              std::move(parameterTypes));
     }
     else if (tokenType == tok_procedure)
     {
         getNextToken(); // eat ;
-        return std::make_unique<PrototypeAST>(idName, std::move(parameters), nullptr);
+        return std::make_unique<PrototypeAST>(idName, std::move(parameters), nullptr, std::move(parameterTypes));
     }
     return nullptr;
 }
 
+// type ::= 'integer' | 'real'
+TypeAST::Type Parser::ParseType() {
+    if (CurTok == tok_real) {
+        consume(tok_real);
+        return TypeAST::Type::DOUBLE;
+    }
+    consume(tok_integer);
+    return TypeAST::Type::INT;
+}
+
 std::unique_ptr<AST> Parser::ParseFunction()
 {
+    Position position = m_Lexer.tokenPosition();
     std::unique_ptr<PrototypeAST> prototype =  ParsePrototype();
     std::vector<std::unique_ptr<VarDeclAST>> variables;
     if (CurTok == tok_forward)
@@ -176,7 +476,9 @@ std::unique_ptr<AST> Parser::ParseFunction()
 
     std::unique_ptr<AST> mainBlock = ParseBlock();
     consume(';');
-    return std::make_unique<FunctionAST>(std::move(prototype), std::move(variables),  std::move(mainBlock));
+    auto function = std::make_unique<FunctionAST>(std::move(prototype), std::move(variables),  std::move(mainBlock));
+    function->setPosition(position);
+    return function;
 }
 
 
@@ -186,6 +488,9 @@ std::unique_ptr<AST> Parser::ParseBlock() {
     std::vector<std::unique_ptr<AST>> body;
 
     while(CurTok != TokenType::tok_end) {
+        // Statements start at their first token
+        Position position = m_Lexer.tokenPosition();
+        size_t statements = body.size();
 //        auto res = Parse
         switch(CurTok) {
             case TokenType::tok_semicolon:
@@ -210,6 +515,12 @@ std::unique_ptr<AST> Parser::ParseBlock() {
             case TokenType::tok_for:
                 body.push_back(ParseForStmt());
                 break;
+            case TokenType::tok_parallel:
+                body.push_back(ParseParallelFor());
+                break;
+            case TokenType::tok_directive:
+                body.push_back(ParseDirectedLoop());
+                break;
             case TokenType::tok_break:
                 consume(tok_break);
                 body.push_back(std::make_unique<LoopBreakAST>());
@@ -218,6 +529,12 @@ std::unique_ptr<AST> Parser::ParseBlock() {
                 body.push_back(std::make_unique<FunctionExitAST>());
                 break;
         }
+        for (size_t i = statements; i < body.size(); i++) {
+            if (!body[i])
+                statementError(position);
+            if (!body[i]->getPosition().getLine())
+                body[i]->setPosition(position);
+        }
     }
     consume(tok_end);
 
@@ -225,6 +542,16 @@ std::unique_ptr<AST> Parser::ParseBlock() {
 };
 
 std::unique_ptr<AST> Parser::ParseOneLineBlock() {
+    Position position = m_Lexer.tokenPosition();
+    std::unique_ptr<AST> statement = ParseOneLineStatement();
+    if (!statement)
+        statementError(position);
+    if (!statement->getPosition().getLine())
+        statement->setPosition(position);
+    return statement;
+}
+
+std::unique_ptr<AST> Parser::ParseOneLineStatement() {
     std::unique_ptr<ExprAST> res = nullptr;
     switch(CurTok) {
         case TokenType::tok_number:
@@ -240,6 +567,10 @@ std::unique_ptr<AST> Parser::ParseOneLineBlock() {
             return ParseIfStmt();
         case TokenType::tok_for:
             return ParseForStmt();
+        case TokenType::tok_parallel:
+            return ParseParallelFor();
+        case TokenType::tok_directive:
+            return ParseDirectedLoop();
         case TokenType::tok_break:
             consume(tok_break);
             return std::make_unique<LoopBreakAST>();
@@ -260,6 +591,7 @@ void Parser::ParseFunctionVarDeclaration(std::vector<std::unique_ptr<VarDeclAST>
             // Const variable name
             while (CurTok == tok_identifier) {
                 std::string idName = m_Lexer.identifierStr();
+                Position position = m_Lexer.tokenPosition();
                 consume(tok_identifier);
                 // Todo: needs to parse multiple var with , , , ,
                 consume('=');
@@ -271,6 +603,7 @@ void Parser::ParseFunctionVarDeclaration(std::vector<std::unique_ptr<VarDeclAST>
                                                             std::move(type),
                                                             std::move(expr),
                                                             true));
+                vars.back()->setPosition(position);
                 consume(';');
             }
         }
@@ -279,16 +612,12 @@ void Parser::ParseFunctionVarDeclaration(std::vector<std::unique_ptr<VarDeclAST>
             // Const variable name
             while (CurTok == tok_identifier) {
                 std::string idName = m_Lexer.identifierStr();
+                Position position = m_Lexer.tokenPosition();
                 consume(tok_identifier);
                 // Todo: needs to parse multiple var with , , , ,
                 consume(':');
 
-                // Can be extended
-                TypeAST::Type typeValue;
-                if (CurTok == tok_integer) {
-                    typeValue = TypeAST::Type::INT;
-                }
-                consume(tok_integer);
+                TypeAST::Type typeValue = ParseType();
 
                 std::unique_ptr<TypeAST> type = std::make_unique<TypeAST>(typeValue);
 
@@ -298,6 +627,7 @@ void Parser::ParseFunctionVarDeclaration(std::vector<std::unique_ptr<VarDeclAST>
                                                             std::move(type),
                                                             std::move(expr),
                                                             false));
+                vars.back()->setPosition(position);
                 consume(';');
             }
         }
@@ -337,12 +667,7 @@ std::unique_ptr<AST> Parser::ParseDeclaration() {
             // Todo: needs to parse multiple var with , , , ,
             consume(':');
 
-            // Can be extended
-            TypeAST::Type typeValue;
-            if (CurTok == tok_integer) {
-                typeValue = TypeAST::Type::INT;
-            }
-            consume(tok_integer);
+            TypeAST::Type typeValue = ParseType();
 
             std::unique_ptr<TypeAST> type = std::make_unique<TypeAST>(typeValue);
 
@@ -369,6 +694,8 @@ std::unique_ptr<AST> Parser::ParseDeclaration() {
  */
 int Parser::getNextToken()
 {
+    TimeReport::Scope scope(m_TimeReport, "lex");
+    m_TokenCount++;
     return CurTok = m_Lexer.gettok();
 }
 
@@ -393,13 +720,17 @@ std::unique_ptr<ExprAST> Parser::ParsePrimary() {
     switch (CurTok) {
         default:
             std::clog << "tok: " << ReturnTokenString(CurTok) << std::endl;
-            return LogError("unknown token when expecting an expression from ParsePrimary -  ");
+            return LogError("Expected an expression, got: " + ReturnTokenString(CurTok));
         case tok_identifier:
             return ParseIdentifierExpr();
         case tok_number:
             return ParseNumberExpr();
+        case tok_real_number:
+            return ParseRealExpr();
         case '(':
             return ParseParenExpr();
+        case tok_not:
+            return ParseNotExpr();
     }
 }
 
@@ -453,6 +784,22 @@ std::unique_ptr<ExprAST> Parser::ParseNumberExpr() {
     return std::move(result);
 }
 
+/// realexpr ::= real number
+std::unique_ptr<ExprAST> Parser::ParseRealExpr() {
+    auto result = std::make_unique<RealExprAST>(m_Lexer.realVal());
+    consume(tok_real_number);
+    return result;
+}
+
+/// notexpr ::= 'not' primary
+std::unique_ptr<ExprAST> Parser::ParseNotExpr() {
+    consume(tok_not);
+    auto operand = ParsePrimary();
+    if (!operand)
+        return nullptr;
+    return std::make_unique<UnaryExprAST>(tok_not, std::move(operand));
+}
+
 std::unique_ptr<ExprAST> Parser::ParseParenExpr() {
     consume(tok_lparen);
     auto result = ParseExpression();
@@ -534,7 +881,8 @@ std::unique_ptr<AST> Parser::ParseIfStmt() {
 
 }
 
-std::unique_ptr<AST> Parser::ParseForStmt() {
+std::unique_ptr<AST> Parser::ParseForStmt(bool parallel) {
+    Position position = m_Lexer.tokenPosition();
     consume(tok_for);
 
     if(CurTok != tok_identifier) {
@@ -561,6 +909,33 @@ std::unique_ptr<AST> Parser::ParseForStmt() {
 
     std::unique_ptr<ExprAST> End = ParseExpression();
 
+    // reductions ::= 'reduce' ident ':' ('+' | 'min' | 'max') {',' ident ':' ('+' | 'min' | 'max')}
+    std::vector<LoopReduction> reductions;
+    if (parallel && CurTok == tok_identifier && m_Lexer.identifierStr() == "reduce") {
+        consume(tok_identifier);
+        for (;;) {
+            if (CurTok != tok_identifier)
+                throw std::runtime_error("Parallel for, expected reduction variable");
+            LoopReduction reduction;
+            reduction.var = m_Lexer.identifierStr();
+            consume(tok_identifier);
+            if (!consume(tok_colon))
+                throw std::runtime_error("Parallel for, expected ':' after reduction variable " + reduction.var);
+            if (CurTok == tok_plus) {
+                reduction.op = "+";
+                consume(tok_plus);
+            } else if (CurTok == tok_identifier && (m_Lexer.identifierStr() == "min" || m_Lexer.identifierStr() == "max")) {
+                reduction.op = m_Lexer.identifierStr();
+                consume(tok_identifier);
+            } else {
+                throw std::runtime_error("Parallel for, reduction of " + reduction.var + " must be +, min or max");
+            }
+            reductions.push_back(reduction);
+            if (!consume(tok_comma))
+                break;
+        }
+    }
+
     std::unique_ptr<AST> Body = nullptr;
 
     consume(tok_do);
@@ -570,10 +945,45 @@ std::unique_ptr<AST> Parser::ParseForStmt() {
     } else {
         Body = ParseOneLineBlock();
     }
-    return std::make_unique<ForStmtAST>(idName,std::move(Start), std::move(End), std::move(Step), std::move(Body));
+    auto loop = std::make_unique<ForStmtAST>(idName,std::move(Start), std::move(End), std::move(Step), std::move(Body));
+    loop->setPosition(position);
+    if (parallel) {
+        loop->setParallel(std::move(reductions));
+        m_HasParallelLoops = true;
+    }
+    return loop;
+}
+
+/// parallelfor ::= 'parallel' forstmt, the for statement may list its reductions before 'do'
+std::unique_ptr<AST> Parser::ParseParallelFor() {
+    consume(tok_parallel);
+    if (CurTok != tok_for)
+        throw std::runtime_error("Expected for after parallel");
+    return ParseForStmt(true);
+}
+
+/// directedloop ::= directive+ (forstmt | parallelfor | whilestmt)
+std::unique_ptr<AST> Parser::ParseDirectedLoop() {
+    LoopDirectives directives;
+    while (CurTok == tok_directive) {
+        applyDirective(m_Lexer.identifierStr(), directives);
+        consume(tok_directive);
+    }
+    if (CurTok == tok_for || CurTok == tok_parallel) {
+        std::unique_ptr<AST> loop = CurTok == tok_for ? ParseForStmt() : ParseParallelFor();
+        static_cast<ForStmtAST &>(*loop).setDirectives(directives);
+        return loop;
+    }
+    if (CurTok == tok_while) {
+        std::unique_ptr<AST> loop = ParseWhileStmt();
+        static_cast<WhileStmtAST &>(*loop).setDirectives(directives);
+        return loop;
+    }
+    throw std::runtime_error("Loop directive " + directives.describe() + " is not followed by a for or while loop");
 }
 
 std::unique_ptr<AST> Parser::ParseWhileStmt() {
+    Position position = m_Lexer.tokenPosition();
     consume(tok_while);
 
     auto Expr =ParseExpression();
@@ -581,7 +991,9 @@ std::unique_ptr<AST> Parser::ParseWhileStmt() {
     consume(tok_do);
     auto Body = ParseBlock();
 
-    return std::make_unique<WhileStmtAST>(std::move(Expr), std::move(Body));
+    auto loop = std::make_unique<WhileStmtAST>(std::move(Expr), std::move(Body));
+    loop->setPosition(position);
+    return loop;
 };
 
 
@@ -611,7 +1023,7 @@ bool Parser::consume(int token) {
 
 int Parser::GetTokenPrecedence() {
 
-    if (!isascii(CurTok) && CurTok != tok_mod && CurTok != tok_div && CurTok != tok_not
+    if (!isascii(CurTok) && CurTok != tok_mod && CurTok != tok_div
         && CurTok != tok_and && CurTok != tok_xor && CurTok != tok_assign && CurTok != tok_equal
         && CurTok != tok_lessequal && CurTok != tok_greaterequal && CurTok != tok_notequal && CurTok != tok_or
     )
@@ -619,7 +1031,9 @@ int Parser::GetTokenPrecedence() {
 
     // Make sure it's a declared binop.
 //    std::clog << "Getting token precedence: " << ReturnTokenString(CurTok) << std::endl;
-    int TokPrec = BinopPrecedence[CurTok];
+    // find, not [], the table is shared by parsers running on several threads
+    auto precIt = BinopPrecedence.find(CurTok);
+    int TokPrec = precIt == BinopPrecedence.end() ? 0 : precIt->second;
 //    std::clog << "Precedence: " << TokPrec << std::endl;
     if (TokPrec <= 0) return -1;
     return TokPrec;
@@ -634,7 +1048,7 @@ void Parser::PrintToken(int token) {
         std::clog << ">" << m_Lexer.identifierStr() << "<";
     }
     else
-        std::clog << ">" << tokenMap[token]  << "<";
+        std::clog << ">" << tokenMap.at(token)  << "<";
 }
 std::string Parser::ReturnTokenString(int token) {
     if(tokenMap.find(token) == tokenMap.end()) {
@@ -645,36 +1059,20 @@ std::string Parser::ReturnTokenString(int token) {
         return m_Lexer.identifierStr();
     }
     else
-        return tokenMap[token];
+        return tokenMap.at(token);
 }
 
-std::unique_ptr<ExprAST> Parser::LogError(const char *string) {
-    fprintf(stderr, "Error: %s\n", string);
-    return nullptr;
+// Thrown rather than printed, the compile server hands the message to the client and keeps serving
+std::unique_ptr<ExprAST> Parser::LogError(const std::string &message) {
+    throw std::runtime_error(message);
 }
 
 
 
-const llvm::Module& Parser::Generate()
+llvm::Module& Parser::Generate()
 {
 
-    // create writeln function
-
-    {
-        std::vector<llvm::Type*> Ints(1, llvm::Type::getInt32Ty(gen.ctx));
-        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getVoidTy(gen.ctx), Ints, false);
-        llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "writeln", gen.module);
-        for (auto & Arg : F->args())
-            Arg.setName("x");
-
-    }
-    {
-        std::vector<llvm::Type*> Ints(1, llvm::Type::getInt32PtrTy(gen.ctx));
-        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getInt32Ty(gen.ctx), Ints, false);
-        llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "readln", gen.module);
-        for (auto & Arg : F->args())
-            Arg.setName("x");
-    }
+    DeclareRuntime(gen);
 
     // create main function
     {
@@ -685,7 +1083,55 @@ const llvm::Module& Parser::Generate()
 //        llvm::BasicBlock * BB = llvm::BasicBlock::Create(gen.ctx, "entry", MainFunction);
 //        gen.builder.SetInsertPoint(BB);
 
-        m_AstTree->codegen(gen);
+        LoadInterfaces();
+        DeclareImports(gen);
+        std::vector<std::pair<std::string, int>> constants;
+        for (auto &constant : m_UnitConstants)
+            constants.emplace_back(constant->getName(), constant->codegenUnitConstant(gen));
+
+        {
+            TimeReport::Scope scope(m_TimeReport, "codegen");
+            std::unique_ptr<DebugInfo> debugInfo;
+            if (!m_DebugSource.empty()) {
+                debugInfo = std::make_unique<DebugInfo>(gen.module, m_DebugSource);
+                gen.debugInfo = debugInfo.get();
+            }
+            // Regions, the compile unit and outlined loop bodies belong to the module, which parallel generation
+            // does not carry over
+            if (m_Jobs > 1 && !gen.sourceProfile && !debugInfo && !m_HasParallelLoops)
+                GenerateParallel();
+            else
+                m_AstTree->codegen(gen);
+            if (debugInfo) {
+                debugInfo->finalize();
+                gen.debugInfo = nullptr;
+            }
+            resetNameCounters(gen.module);
+        }
+
+        // Before the runtime is linked in, only the program's own routines are counted
+        if (!m_ProfileGenerate.empty())
+            instrumentModule(gen.module, m_ProfileGenerate);
+        if (!m_ProfileUse.empty())
+            applyProfile(gen.module, m_ProfileUse, *m_Diagnostics);
+
+        std::set<std::string> exported = {"main"};
+        if (!m_UnitName.empty()) {
+            exported = std::set<std::string>(m_Exports.begin(), m_Exports.end());
+            WriteInterface(constants);
+        } else if (m_Uses.empty() && m_LinkRuntime) {
+            // runtime functions become part of the program, so they can be inlined.
+            // Programs built from units keep calling the shared fce.c, a private copy would buffer output on its own.
+            TimeReport::Scope scope(m_TimeReport, "runtime linking");
+            linkRuntime(gen.module);
+        }
+
+        // attributes let LLVM move and merge calls of routines without side effects
+        TimeReport::Scope scope(m_TimeReport, "effect analysis");
+        annotateFunctionEffects(gen.module, exported);
+        // Broken IR is a bug of the compiler, report it here instead of leaving it to llc
+        if (llvm::verifyModule(gen.module, &llvm::errs()))
+            throw std::runtime_error("Generated code does not verify");
 
         // call writeln with value from lexel
 //        gen.builder.CreateCall(gen.module.getFunction("writeln"), {
@@ -700,3 +1146,347 @@ const llvm::Module& Parser::Generate()
     return this->gen.module;
 }
 
+
+// Declarations of the fce.c routines, write, writeln and readln have variants for reals
+void Parser::DeclareRuntime(GenContext &context) {
+    {
+        std::vector<llvm::Type*> Ints(1, llvm::Type::getInt32Ty(context.ctx));
+        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getVoidTy(context.ctx), Ints, false);
+        llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "writeln", context.module);
+        for (auto & Arg : F->args())
+            Arg.setName("x");
+
+    }
+    {
+        std::vector<llvm::Type*> Ints(1, llvm::Type::getInt32Ty(context.ctx));
+        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getVoidTy(context.ctx), Ints, false);
+        llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "write", context.module);
+        for (auto & Arg : F->args())
+            Arg.setName("x");
+    }
+    {
+        std::vector<llvm::Type*> Ints(1, llvm::Type::getInt32PtrTy(context.ctx));
+        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getInt32Ty(context.ctx), Ints, false);
+        llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "readln", context.module);
+        for (auto & Arg : F->args())
+            Arg.setName("x");
+    }
+    for (const char *name : {"writeln_real", "write_real"}) {
+        std::vector<llvm::Type*> Reals(1, llvm::Type::getDoubleTy(context.ctx));
+        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getVoidTy(context.ctx), Reals, false);
+        llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, name, context.module);
+        for (auto & Arg : F->args())
+            Arg.setName("x");
+    }
+    {
+        std::vector<llvm::Type*> Reals(1, llvm::Type::getDoublePtrTy(context.ctx));
+        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getInt32Ty(context.ctx), Reals, false);
+        llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "readln_real", context.module);
+        for (auto & Arg : F->args())
+            Arg.setName("x");
+    }
+    {
+        // mila_parallel_for(first, last, body, env) runs body(first', last', env) for chunks of first..last
+        llvm::Type * Int = llvm::Type::getInt32Ty(context.ctx);
+        llvm::Type * Bytes = llvm::Type::getInt8PtrTy(context.ctx);
+        llvm::FunctionType * BodyType = llvm::FunctionType::get(llvm::Type::getVoidTy(context.ctx), {Int, Int, Bytes}, false);
+        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getVoidTy(context.ctx),
+                {Int, Int, BodyType->getPointerTo(), Bytes}, false);
+        llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "mila_parallel_for", context.module);
+    }
+    for (const char *name : {"mila_parallel_lock", "mila_parallel_unlock"}) {
+        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getVoidTy(context.ctx), false);
+        llvm::Function::Create(FT, llvm::Function::ExternalLinkage, name, context.module);
+    }
+}
+
+/**
+ * @brief Reads the interfaces of the used units.
+ *
+ * Only the interface files are read, the units themselves are compiled separately and linked in later.
+ */
+void Parser::LoadInterfaces() {
+    std::vector<std::string> dirs = m_InterfaceDirs;
+    if (dirs.empty())
+        dirs.push_back(".");
+
+    m_Imports.clear();
+    for (const std::string &unit : m_Uses) {
+        std::string path;
+        for (const std::string &dir : dirs) {
+            std::string candidate = dir + "/" + unit + ".mili";
+            if (std::ifstream(candidate)) {
+                path = candidate;
+                break;
+            }
+        }
+        if (path.empty())
+            throw std::runtime_error("Interface of unit " + unit + " not found, compile the unit first");
+
+        m_Imports.push_back(UnitInterface::read(path));
+        if (m_Imports.back().name != unit)
+            throw std::runtime_error("Interface " + path + " belongs to unit " + m_Imports.back().name);
+    }
+}
+
+// Declares everything the used units export
+void Parser::DeclareImports(GenContext &context) {
+    for (const UnitInterface &imported : m_Imports) {
+        for (const auto &constant : imported.constants) {
+            if (context.globalSymbols.count(constant.first))
+                throw std::runtime_error("Already exists const: " + constant.first);
+            llvm::Value *value = llvm::ConstantInt::get(llvm::Type::getInt32Ty(context.ctx), constant.second, true);
+            context.globalSymbols[constant.first] = {nullptr, true, value};
+        }
+        for (const UnitInterface::Routine &routine : imported.routines) {
+            if (context.module.getFunction(routine.name))
+                throw std::runtime_error("Routine exported by more than one unit: " + routine.name);
+            std::unique_ptr<VarDeclAST> returnValue = nullptr;
+            if (!routine.procedure)
+                returnValue = std::make_unique<VarDeclAST>(routine.name, std::make_unique<TypeAST>(
+                        routine.realResult ? TypeAST::Type::DOUBLE : TypeAST::Type::INT), nullptr, false);
+            std::vector<TypeAST::Type> argTypes;
+            for (bool real : routine.realArgs)
+                argTypes.push_back(real ? TypeAST::Type::DOUBLE : TypeAST::Type::INT);
+            PrototypeAST(routine.name, routine.args, std::move(returnValue), std::move(argTypes)).codegen(context);
+        }
+    }
+}
+
+void Parser::WriteInterface(const std::vector<std::pair<std::string, int>> &constants) {
+    UnitInterface exported;
+    exported.name = m_UnitName;
+    exported.constants = constants;
+    for (const std::string &name : m_Exports) {
+        llvm::Function *F = gen.module.getFunction(name);
+        if (F->isDeclaration())
+            throw std::runtime_error("Unit " + m_UnitName + " does not implement " + name);
+        UnitInterface::Routine routine;
+        routine.name = name;
+        routine.procedure = F->getReturnType()->isVoidTy();
+        routine.realResult = F->getReturnType()->isDoubleTy();
+        for (const llvm::Argument &arg : F->args()) {
+            routine.args.push_back(arg.getName().str());
+            routine.realArgs.push_back(arg.getType()->isDoubleTy());
+        }
+        exported.routines.push_back(std::move(routine));
+    }
+    exported.write(m_InterfaceFile.empty() ? m_UnitName + ".mili" : m_InterfaceFile);
+}
+
+namespace {
+
+// Identifies the compiler build, objects generated by another build are not reused
+std::string compilerStamp() {
+    std::string path = llvm::sys::fs::getMainExecutable(nullptr, nullptr);
+    llvm::sys::fs::file_status status;
+    if (path.empty() || llvm::sys::fs::status(path, status))
+        return "unknown";
+    return path + " " + std::to_string(status.getSize()) + " "
+        + std::to_string(status.getLastModificationTime().time_since_epoch().count());
+}
+
+std::string sha1Hex(const std::string &text) {
+    llvm::SHA1 hash;
+    hash.update(text);
+    return llvm::toHex(hash.final(), true);
+}
+
+// Where every node of the subtree starts, the printed tree leaves positions out but debug info depends on them
+void printPositions(const AST &node, std::ostream &out) {
+    out << " " << node.getPosition();
+    node.forEachChild([&out](const AST &child) { printPositions(child, out); });
+}
+
+}
+
+/**
+ * @brief Compiles every routine of the program into an object of its own, reusing the objects of unchanged routines.
+ *
+ * A routine's object is named after a hash of its printed AST (with the positions of its nodes under debug
+ * info), the prototypes of the routines it calls, the used unit interfaces, the optimisation level and the
+ * compiler build. Only routines without such an object are generated, each into a module of its own, so the work
+ * done follows the size of the change rather than of the file. Routines keep external linkage and know nothing
+ * about the effects of their callees, which costs some optimisation compared to Generate().
+ * Returns the objects to link, in source order.
+ */
+std::vector<std::string> Parser::GenerateIncremental(const std::string &cacheDir, unsigned optLevel) {
+    if (!m_UnitName.empty())
+        throw std::runtime_error("Incremental compilation is for programs, units are compiled separately already");
+    LoadInterfaces();
+
+    std::vector<FunctionAST *> functions;
+    std::set<std::string> names;
+    std::map<std::string, std::string> signatures;
+    for (const auto &stmt : static_cast<BlockAST &>(*m_AstTree).getBody()) {
+        auto *function = static_cast<FunctionAST *>(stmt.get());
+        std::ostringstream prototype;
+        function->getPrototype().print(prototype);
+        functions.push_back(function);
+        names.insert(function->getPrototype().getName());
+        signatures[function->getPrototype().getName()] = prototype.str();
+    }
+
+    // What every routine depends on
+    std::ostringstream common;
+    common << compilerStamp() << "\n-O" << optLevel << "\n";
+    if (!m_DebugSource.empty())
+        common << "-g " << m_DebugSource << "\n";
+    if (gen.fastMath)
+        common << "--fast-math\n";
+    for (const UnitInterface &imported : m_Imports) {
+        common << "unit " << imported.name << "\n";
+        for (const auto &constant : imported.constants)
+            common << constant.first << " = " << constant.second << "\n";
+        for (const UnitInterface::Routine &routine : imported.routines) {
+            std::string signature = (routine.procedure ? "procedure " : "function ") + routine.name;
+            for (size_t i = 0; i < routine.args.size(); i++)
+                signature += " " + routine.args[i] + (routine.realArgs[i] ? ": real" : "");
+            if (routine.realResult)
+                signature += ": real";
+            signatures.emplace(routine.name, signature);
+        }
+    }
+    std::string commonHash = sha1Hex(common.str());
+
+    std::vector<std::string> objects;
+    size_t generated = 0;
+    for (FunctionAST *function : functions) {
+        if (!function->hasBody())
+            continue;
+
+        std::ostringstream text;
+        text << commonHash << "\n";
+        function->print(text);
+        if (!m_DebugSource.empty()) {
+            text << "\nat";
+            printPositions(*function, text);
+        }
+        std::set<std::string> callees;
+        function->collectCallees(callees);
+        for (const std::string &callee : callees)
+            text << "\ncalls " << callee << " " << signatures[callee];
+        std::string object = cacheDir + "/" + sha1Hex(text.str()) + ".o";
+        objects.push_back(object);
+
+        std::error_code ec;
+        if (std::filesystem::exists(object, ec)) {
+            // Keeps the object fresh for the least recently used eviction of the wrapper
+            std::filesystem::last_write_time(object, std::filesystem::file_time_type::clock::now(), ec);
+            continue;
+        }
+
+        GenContext context(function->getPrototype().getName());
+        context.fastMath = gen.fastMath;
+        DeclareRuntime(context);
+        DeclareImports(context);
+        callees.insert(function->getPrototype().getName());
+        for (FunctionAST *other : functions) {
+            const std::string &name = other->getPrototype().getName();
+            if (callees.count(name) && !context.module.getFunction(name))
+                other->getPrototype().codegen(context);
+        }
+        std::unique_ptr<DebugInfo> debugInfo;
+        if (!m_DebugSource.empty()) {
+            debugInfo = std::make_unique<DebugInfo>(context.module, m_DebugSource);
+            context.debugInfo = debugInfo.get();
+        }
+        function->codegen(context);
+        if (debugInfo)
+            debugInfo->finalize();
+        annotateFunctionEffects(context.module, names);
+        if (llvm::verifyModule(context.module, &llvm::errs()))
+            throw std::runtime_error("Generated code of " + function->getPrototype().getName() + " does not verify");
+        optimizeModule(context.module, optLevel, nullptr, *m_Diagnostics);
+        emitObject(context.module, object);
+        generated++;
+    }
+    std::clog << "Incremental: generated " << generated << " of " << objects.size() << " routines" << std::endl;
+    return objects;
+}
+
+/**
+ * @brief Generates routine bodies on m_Jobs threads, producing the same module as m_AstTree->codegen(gen).
+ *
+ * An LLVMContext must not be used by two threads, so every routine is generated into a context and module of its
+ * own, with all prototypes declared in source order just like in the sequential mode. The modules travel back
+ * to the main context as bitcode and their bodies are moved into the declarations of the main module in source
+ * order, so the result does not depend on which thread finished first.
+ */
+void Parser::GenerateParallel() {
+    std::vector<FunctionAST *> functions;
+    for (const auto &stmt : static_cast<BlockAST &>(*m_AstTree).getBody()) {
+        auto *function = static_cast<FunctionAST *>(stmt.get());
+        functions.push_back(function);
+        if (!gen.module.getFunction(function->getPrototype().getName()))
+            function->getPrototype().codegen(gen);
+    }
+
+    std::vector<llvm::SmallVector<char, 0>> bitcode(functions.size());
+    std::vector<std::exception_ptr> errors(functions.size());
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < functions.size(); i = next++) {
+            if (!functions[i]->hasBody())
+                continue;
+            try {
+                GenContext context("mila");
+                context.timeReport = gen.timeReport;
+                context.fastMath = gen.fastMath;
+                DeclareRuntime(context);
+                DeclareImports(context);
+                for (auto &constant : m_UnitConstants)
+                    constant->codegenUnitConstant(context);
+                // Only the routine and its callees, declaring everything would make the work quadratic
+                std::set<std::string> callees;
+                functions[i]->collectCallees(callees);
+                callees.insert(functions[i]->getPrototype().getName());
+                for (FunctionAST *function : functions) {
+                    const std::string &name = function->getPrototype().getName();
+                    if (callees.count(name) && !context.module.getFunction(name))
+                        function->getPrototype().codegen(context);
+                }
+                functions[i]->codegen(context);
+                llvm::raw_svector_ostream out(bitcode[i]);
+                llvm::WriteBitcodeToFile(context.module, out);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < m_Jobs; t++)
+        threads.emplace_back(worker);
+    for (std::thread &thread : threads)
+        thread.join();
+
+    for (size_t i = 0; i < functions.size(); i++) {
+        // Report the error sequential generation would have stopped at
+        if (errors[i])
+            std::rethrow_exception(errors[i]);
+        if (!functions[i]->hasBody())
+            continue;
+
+        const std::string &name = functions[i]->getPrototype().getName();
+        llvm::MemoryBufferRef buffer(llvm::StringRef(bitcode[i].data(), bitcode[i].size()), name);
+        llvm::Expected<std::unique_ptr<llvm::Module>> part = llvm::parseBitcodeFile(buffer, gen.ctx);
+        if (!part)
+            throw std::runtime_error("Cannot read generated routine " + name + ": " + llvm::toString(part.takeError()));
+
+        // Routines of the part stand for the routines of the same name in the final module
+        llvm::ValueToValueMapTy map;
+        for (llvm::Function &F : **part)
+            map[&F] = gen.module.getFunction(F.getName());
+        llvm::Function *source = (*part)->getFunction(name);
+        llvm::Function *target = gen.module.getFunction(name);
+        auto targetArg = target->arg_begin();
+        for (llvm::Argument &arg : source->args())
+            map[&arg] = &*targetArg++;
+        llvm::SmallVector<llvm::ReturnInst *, 4> returns;
+        llvm::CloneFunctionInto(target, source, map, llvm::CloneFunctionChangeType::DifferentModule, returns);
+    }
+    // Cloning across modules registers the (absent) debug info compile units, sequential output has no such node
+    llvm::NamedMDNode *compileUnits = gen.module.getNamedMetadata("llvm.dbg.cu");
+    if (compileUnits && compileUnits->getNumOperands() == 0)
+        gen.module.eraseNamedMetadata(compileUnits);
+}
@@ -3,9 +3,14 @@
 
 
 #include <fstream>
+#include <iostream>
+#include <set>
 
 #include "Lexer.hpp"
 #include "AST.hpp"
+#include "CompilerOptions.hpp"
+#include "TimeReport.hpp"
+#include "UnitInterface.hpp"
 
 
 static std::map<int, std::string> tokenMap = {
@@ -41,6 +46,14 @@ static std::map<int, std::string> tokenMap = {
         {-30, "tok_to"},
         {-31, "tok_downto"},
         {-32, "tok_array"},
+        {-35, "tok_unit"},
+        {-36, "tok_uses"},
+        {-37, "tok_interface"},
+        {-38, "tok_implementation"},
+        {-39, "tok_real"},
+        {-40, "tok_real_number"},
+        {-41, "tok_directive"},
+        {-42, "tok_parallel"},
         {'+', "+"},
         {'-', "-"},
         {'*', "*"},
@@ -77,7 +90,6 @@ static std::map<char, int> BinopPrecedence = {
         {'*', 40},
         {'/', 40},
 
-        {tok_not, 5},
         {tok_mod, 40},
         {tok_div, 40},
         {tok_and, 80},
@@ -88,12 +100,39 @@ static std::map<char, int> BinopPrecedence = {
 class Parser {
 public:
     Parser();
+    explicit Parser(std::istream &input);
     ~Parser() = default;
 
     // Program identifier;
     bool Parse();             // parse
-    const llvm::Module& Generate();  // generate
+    llvm::Module& Generate();  // generate
+    // Per-routine objects cached in cacheDir, see Parser.cpp
+    std::vector<std::string> GenerateIncremental(const std::string &cacheDir, unsigned optLevel);
     void printCurrentToken();
+
+    // Directory searched for interfaces of used units, the current directory when none is given
+    void addInterfaceDir(const std::string &dir);
+    // Where the interface of a compiled unit goes, <unit name>.mili by default
+    void setInterfaceFile(const std::string &path);
+    // Number of threads generating routine bodies, the output does not depend on it
+    void setJobs(unsigned jobs);
+    // Phases of Parse and Generate are timed into report, none when null
+    void setTimeReport(TimeReport *report);
+    // Where warnings go, stderr unless the compile server collects them for its reply
+    void setDiagnostics(std::ostream &out);
+    // Whether programs get the embedded runtime linked in, off when the caller provides writeln and friends
+    void setLinkRuntime(bool link);
+    // Profile-guided optimisation, see Profile.hpp: counters written to path at exit, or a profile applied
+    void setProfileGenerate(const std::string &path);
+    void setProfileUse(const std::string &path);
+    // Routines and loops report their time at exit (--profile), see SourceProfile.hpp
+    void setSourceProfile(bool profile);
+    // DWARF for the source at sourcePath (-g), none when empty
+    void setDebugInfo(const std::string &sourcePath);
+    // Floating-point operations may be reassociated and vectorised (--fast-math), results can change in the last bits
+    void setFastMath(bool fastMath);
+    // Everything of options that concerns compiling one program: interfaces, jobs, profiles, -g and --fast-math
+    void setOptions(const CompilerOptions &options);
 private:
     int getNextToken();
     Lexer m_Lexer;                   // lexer is used to read tokens
@@ -103,6 +142,26 @@ private:
     GenContext gen;
 
     std::unique_ptr<AST> m_AstTree;
+
+    // Separate compilation
+    std::vector<std::string> m_InterfaceDirs;
+    std::string m_InterfaceFile;
+    std::string m_UnitName;                                 // empty when compiling a program
+    std::vector<std::string> m_Uses;
+    std::vector<std::unique_ptr<VarDeclAST>> m_UnitConstants;
+    std::vector<std::string> m_Exports;                     // routines declared in the unit interface
+    std::vector<UnitInterface> m_Imports;
+    unsigned m_Jobs = 1;
+    TimeReport *m_TimeReport = nullptr;
+    std::ostream *m_Diagnostics = &std::cerr;
+    bool m_LinkRuntime = true;
+    std::string m_ProfileGenerate;
+    std::string m_ProfileUse;
+    std::string m_DebugSource;
+    // Outlined loop bodies have no counterpart in the AST, GenerateParallel cannot carry them over
+    bool m_HasParallelLoops = false;
+    std::uint64_t m_TokenCount = 0;
+
     void printAST();
     bool consume(int token);
 
@@ -120,14 +179,24 @@ private:
     //            -> one line expression (function call, etc...)
     std::unique_ptr<AST> ParseFunction();
     std::unique_ptr<PrototypeAST> ParsePrototype();
+    TypeAST::Type ParseType();
     void ParseFunctionVarDeclaration(std::vector<std::unique_ptr<VarDeclAST>> & vars);
 
     std::unique_ptr<AST> ParseModule();
+    std::unique_ptr<AST> ParseUnit();
+    void ParseUses();
+    void DeclareRuntime(GenContext &context);
+    void LoadInterfaces();
+    void DeclareImports(GenContext &context);
+    void GenerateParallel();
+    void WriteInterface(const std::vector<std::pair<std::string, int>> &constants);
     std::unique_ptr<AST> ParseMainModule();
 
     std::unique_ptr<AST> ParseDeclaration(); // can be definition as well
     std::unique_ptr<AST> ParseBlock();
     std::unique_ptr<AST> ParseOneLineBlock();
+    std::unique_ptr<AST> ParseOneLineStatement();
+    std::unique_ptr<AST> ParseDirectedLoop();
 
     std::unique_ptr<AST> ParseStatement();
     std::unique_ptr<ExprAST> ParseExpression();
@@ -137,17 +206,20 @@ private:
     std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,
                                                std::unique_ptr<ExprAST> LHS);
     std::unique_ptr<ExprAST> ParseNumberExpr();
+    std::unique_ptr<ExprAST> ParseRealExpr();
     std::unique_ptr<ExprAST> ParseParenExpr();
+    std::unique_ptr<ExprAST> ParseNotExpr();
     std::unique_ptr<ExprAST> ParseIdentifierExpr();
 
     std::unique_ptr<AST> ParseIfStmt();
-    std::unique_ptr<AST> ParseForStmt();
+    std::unique_ptr<AST> ParseForStmt(bool parallel = false);
+    std::unique_ptr<AST> ParseParallelFor();
     std::unique_ptr<AST> ParseWhileStmt();
     int GetTokenPrecedence();
 
     void PrintToken(int token);
     std::string ReturnTokenString(int token);
-    std::unique_ptr<ExprAST> LogError(const char *string);
+    std::unique_ptr<ExprAST> LogError(const std::string &message);
 
     };
 
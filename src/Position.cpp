@@ -0,0 +1,14 @@
+#include "Position.hpp"
+
+std::ostream& operator<<(std::ostream& os, const Position& tk) noexcept {
+    return os << tk.m_line << ":" << tk.m_col;
+}
+
+void Position::advance() {
+    m_col++;
+}
+
+void Position::line() {
+    m_line++;
+    m_col = 1;
+}
@@ -1,13 +1,26 @@
+#ifndef MILA_POSITION_HPP
+#define MILA_POSITION_HPP
 
+#include <ostream>
+
+/// Line and column in the source, both counted from 1. 0:0 stands for no position, nodes the parser made up.
 class Position {
-    unsigned m_line;
-    unsigned m_col;
+    unsigned m_line = 0;
+    unsigned m_col = 0;
 
 public:
-    // Position() = default;
+    Position() = default;
+    Position(unsigned line, unsigned col) : m_line(line), m_col(col) {}
     // Position(const Position& other) = default;
 
+    unsigned getLine() const { return m_line; }
+    unsigned getColumn() const { return m_col; }
+
     friend std::ostream& operator<<(std::ostream& os, const Position& tk) noexcept;
+    // Next column of the same line
     void advance();
+    // First column of the next line
     void line();
-};
\ No newline at end of file
+};
+
+#endif // MILA_POSITION_HPP
@@ -0,0 +1,211 @@
+#include "Profile.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/ProfileData/InstrProf.h>
+#include <llvm/ProfileData/ProfileCommon.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+namespace {
+
+std::vector<llvm::BranchInst *> conditionalBranches(llvm::Function &function) {
+    std::vector<llvm::BranchInst *> branches;
+    for (llvm::BasicBlock &block : function) {
+        auto *branch = llvm::dyn_cast<llvm::BranchInst>(block.getTerminator());
+        if (branch && branch->isConditional())
+            branches.push_back(branch);
+    }
+    return branches;
+}
+
+// FNV-1a over the size and successor count of every block, debug intrinsics (-g) do not count
+std::uint64_t cfgChecksum(const llvm::Function &function) {
+    std::uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](std::uint64_t value) {
+        hash ^= value;
+        hash *= 1099511628211ull;
+    };
+    for (const llvm::BasicBlock &block : function) {
+        mix(block.sizeWithoutDebug());
+        mix(block.getTerminator() ? block.getTerminator()->getNumSuccessors() : 0);
+    }
+    return hash;
+}
+
+llvm::Constant *stringConstant(llvm::Module &module, llvm::StringRef value) {
+    llvm::Constant *data = llvm::ConstantDataArray::getString(module.getContext(), value);
+    auto *global = new llvm::GlobalVariable(module, data->getType(), true, llvm::GlobalValue::PrivateLinkage, data,
+            "__mila_profile_name");
+    global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    return llvm::ConstantExpr::getPointerCast(global, llvm::Type::getInt8PtrTy(module.getContext()));
+}
+
+void increment(llvm::IRBuilder<> &builder, llvm::GlobalVariable *counters, llvm::Value *index) {
+    llvm::Value *counter = builder.CreateInBoundsGEP(counters->getValueType(), counters,
+            {builder.getInt64(0), index});
+    llvm::Value *value = builder.CreateLoad(builder.getInt64Ty(), counter);
+    builder.CreateStore(builder.CreateAdd(value, builder.getInt64(1)), counter);
+}
+
+struct FunctionProfile {
+    std::uint64_t checksum;
+    std::vector<std::uint64_t> counts;
+};
+
+// Lines of the same routine are summed, a line with another checksum (the program changed) starts over
+std::map<std::string, FunctionProfile> readProfile(const std::string &path) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("Cannot read profile " + path);
+
+    std::map<std::string, FunctionProfile> profile;
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); number++) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string name;
+        FunctionProfile record;
+        size_t count = 0;
+        if (!(fields >> name >> record.checksum >> count))
+            throw std::runtime_error("Malformed profile " + path + " at line " + std::to_string(number));
+        record.counts.resize(count);
+        for (std::uint64_t &value : record.counts)
+            if (!(fields >> value))
+                throw std::runtime_error("Malformed profile " + path + " at line " + std::to_string(number));
+
+        auto existing = profile.find(name);
+        if (existing == profile.end() || existing->second.checksum != record.checksum
+            || existing->second.counts.size() != count) {
+            profile[name] = std::move(record);
+            continue;
+        }
+        for (size_t i = 0; i < count; i++)
+            existing->second.counts[i] += record.counts[i];
+    }
+    return profile;
+}
+
+}
+
+void instrumentModule(llvm::Module &module, const std::string &profilePath) {
+    llvm::LLVMContext &ctx = module.getContext();
+    std::vector<llvm::Function *> functions;
+    size_t total = 0;
+    for (llvm::Function &function : module) {
+        if (function.isDeclaration())
+            continue;
+        functions.push_back(&function);
+        total += 1 + 2 * conditionalBranches(function).size();
+    }
+    if (functions.empty())
+        return;
+
+    auto *counterArray = llvm::ArrayType::get(llvm::Type::getInt64Ty(ctx), total);
+    auto *counters = new llvm::GlobalVariable(module, counterArray, false, llvm::GlobalValue::InternalLinkage,
+            llvm::ConstantAggregateZero::get(counterArray), "__mila_profile_counters");
+
+    // struct mila_profile_function of fce.c
+    auto *recordType = llvm::StructType::get(ctx, {llvm::Type::getInt8PtrTy(ctx), llvm::Type::getInt64Ty(ctx),
+            llvm::Type::getInt32Ty(ctx), llvm::Type::getInt64PtrTy(ctx)});
+    std::vector<llvm::Constant *> records;
+    llvm::IRBuilder<> builder(ctx);
+    size_t base = 0;
+    for (llvm::Function *function : functions) {
+        std::vector<llvm::BranchInst *> branches = conditionalBranches(*function);
+        std::uint64_t checksum = cfgChecksum(*function);
+
+        builder.SetInsertPoint(&*function->getEntryBlock().getFirstInsertionPt());
+        increment(builder, counters, builder.getInt64(base));
+        for (size_t i = 0; i < branches.size(); i++) {
+            builder.SetInsertPoint(branches[i]);
+            llvm::Value *edge = builder.CreateSelect(branches[i]->getCondition(),
+                    builder.getInt64(base + 1 + 2 * i), builder.getInt64(base + 2 + 2 * i));
+            increment(builder, counters, edge);
+        }
+
+        size_t count = 1 + 2 * branches.size();
+        llvm::Constant *first = llvm::ConstantExpr::getInBoundsGetElementPtr(counterArray, counters,
+                llvm::ArrayRef<llvm::Constant *>{builder.getInt64(0), builder.getInt64(base)});
+        records.push_back(llvm::ConstantStruct::get(recordType, {stringConstant(module, function->getName()),
+                builder.getInt64(checksum), builder.getInt32(count), first}));
+        base += count;
+    }
+
+    auto *recordArray = llvm::ArrayType::get(recordType, records.size());
+    auto *table = new llvm::GlobalVariable(module, recordArray, true, llvm::GlobalValue::PrivateLinkage,
+            llvm::ConstantArray::get(recordArray, records), "__mila_profile_functions");
+    // struct mila_profile_module of fce.c
+    llvm::Constant *moduleFields[] = {
+            stringConstant(module, profilePath),
+            builder.getInt32(records.size()),
+            llvm::ConstantExpr::getInBoundsGetElementPtr(recordArray, table,
+                    llvm::ArrayRef<llvm::Constant *>{builder.getInt64(0), builder.getInt64(0)}),
+    };
+    llvm::Constant *moduleRecord = llvm::ConstantStruct::getAnon(ctx, moduleFields);
+    auto *moduleGlobal = new llvm::GlobalVariable(module, moduleRecord->getType(), true,
+            llvm::GlobalValue::PrivateLinkage, moduleRecord, "__mila_profile_module");
+
+    llvm::FunctionCallee registerModule = module.getOrInsertFunction("mila_profile_register",
+            llvm::Type::getVoidTy(ctx), llvm::Type::getInt8PtrTy(ctx));
+    auto *init = llvm::Function::Create(llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), false),
+            llvm::GlobalValue::InternalLinkage, "__mila_profile_init", module);
+    builder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", init));
+    builder.CreateCall(registerModule, builder.CreatePointerCast(moduleGlobal, llvm::Type::getInt8PtrTy(ctx)));
+    builder.CreateRetVoid();
+    llvm::appendToGlobalCtors(module, init, 0);
+}
+
+void applyProfile(llvm::Module &module, const std::string &profilePath, std::ostream &diagnostics) {
+    std::map<std::string, FunctionProfile> profile = readProfile(profilePath);
+    llvm::LLVMContext &ctx = module.getContext();
+    llvm::MDBuilder metadata(ctx);
+    llvm::InstrProfSummaryBuilder summary(llvm::ProfileSummaryBuilder::DefaultCutoffs);
+
+    std::vector<std::string> stale;
+    for (llvm::Function &function : module) {
+        if (function.isDeclaration())
+            continue;
+        std::vector<llvm::BranchInst *> branches = conditionalBranches(function);
+        auto found = profile.find(function.getName().str());
+        if (found == profile.end() || found->second.checksum != cfgChecksum(function)
+            || found->second.counts.size() != 1 + 2 * branches.size()) {
+            stale.push_back(function.getName().str());
+            continue;
+        }
+
+        const std::vector<std::uint64_t> &counts = found->second.counts;
+        function.setEntryCount(llvm::Function::ProfileCount(counts[0], llvm::Function::PCT_Real));
+        summary.addRecord(llvm::InstrProfRecord(counts));
+        for (size_t i = 0; i < branches.size(); i++) {
+            std::uint64_t taken = counts[1 + 2 * i], notTaken = counts[2 + 2 * i];
+            if (taken == 0 && notTaken == 0)
+                continue;
+            // Weights are 32 bit, only their ratio matters
+            std::uint64_t scale = std::max(taken, notTaken) / std::numeric_limits<std::uint32_t>::max() + 1;
+            branches[i]->setMetadata(llvm::LLVMContext::MD_prof, metadata.createBranchWeights(
+                    static_cast<std::uint32_t>(taken / scale), static_cast<std::uint32_t>(notTaken / scale)));
+        }
+    }
+    module.setProfileSummary(summary.getSummary()->getMD(ctx), llvm::ProfileSummary::PSK_Instr);
+
+    if (!stale.empty()) {
+        diagnostics << "Warning: profile " << profilePath << " has no matching counters for";
+        for (const std::string &name : stale)
+            diagnostics << " " << name;
+        diagnostics << ", they are optimised without it" << std::endl;
+    }
+}
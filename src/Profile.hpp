@@ -0,0 +1,34 @@
+#ifndef MILA_PROFILE_HPP
+#define MILA_PROFILE_HPP
+
+#include <ostream>
+#include <string>
+
+#include <llvm/IR/Module.h>
+
+/*
+ * Profile-guided optimisation without compiler-rt: the counters are plain globals of the program and fce.c
+ * writes them out at exit. Counters of a routine: its entry, then the taken and the not taken edge of every
+ * conditional branch in block order. Both sides run on the module as it comes out of codegen, before any
+ * optimisation, and a checksum of the control flow graph ties the counters to the routine they were taken from.
+ */
+
+/**
+ * @brief Adds the counters to every routine defined in the module (--profile-generate).
+ *
+ * A constructor hands them to mila_profile_register of fce.c, which appends one line per routine to
+ * profilePath ($MILA_PROFILE_FILE when set) at exit: name, checksum, number of counters and the counters.
+ * Runs of the program add up, a relative path is relative to the directory the program runs in.
+ */
+void instrumentModule(llvm::Module &module, const std::string &profilePath);
+
+/**
+ * @brief Attaches the profile to the module (--profile-use): function entry counts, branch weights and the
+ * profile summary, which the inliner, block placement and loop passes use to tell hot code from cold.
+ *
+ * Routines the profile has no matching counters for (changed since, or new) are left as they are and named
+ * in a warning on diagnostics. Throws std::runtime_error when the file cannot be read or is not a profile.
+ */
+void applyProfile(llvm::Module &module, const std::string &profilePath, std::ostream &diagnostics);
+
+#endif // MILA_PROFILE_HPP
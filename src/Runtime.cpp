@@ -0,0 +1,38 @@
+#include "Runtime.hpp"
+
+#include <cstddef>
+#include <stdexcept>
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+
+// Generated by cmake/embed_bitcode.cmake
+extern const unsigned char milaRuntimeBitcode[];
+extern const std::size_t milaRuntimeBitcodeSize;
+
+bool linkRuntime(llvm::Module &module) {
+    if (milaRuntimeBitcodeSize == 0)
+        return false;
+
+    llvm::MemoryBufferRef buffer(
+            llvm::StringRef(reinterpret_cast<const char *>(milaRuntimeBitcode), milaRuntimeBitcodeSize), "fce.bc");
+    llvm::Expected<std::unique_ptr<llvm::Module>> runtime = llvm::parseBitcodeFile(buffer, module.getContext());
+    if (!runtime) {
+        throw std::runtime_error("Broken embedded runtime: " + llvm::toString(runtime.takeError()));
+    }
+
+    // Pull in only what the program needs and hide all of it from the outside world
+    bool failed = llvm::Linker::linkModules(module, std::move(*runtime), llvm::Linker::LinkOnlyNeeded,
+            [](llvm::Module &M, const llvm::StringSet<> &linked) {
+                llvm::internalizeModule(M, [&linked](const llvm::GlobalValue &GV) {
+                    return !GV.hasName() || !linked.count(GV.getName());
+                });
+            });
+    if (failed) {
+        throw std::runtime_error("Failed to link the runtime");
+    }
+    return true;
+}
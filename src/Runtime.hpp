@@ -0,0 +1,16 @@
+#ifndef MILA_RUNTIME_HPP
+#define MILA_RUNTIME_HPP
+
+#include <llvm/IR/Module.h>
+
+/**
+ * @brief Links the runtime (fce.c, compiled to bitcode at build time) into the module.
+ *
+ * Only runtime functions the program refers to are linked, and all of them get internal linkage,
+ * so the optimizer is free to inline and specialise them into the program.
+ * Returns false when the compiler was built without an embedded runtime (no clang available),
+ * the program then calls the separately compiled fce.c as before.
+ */
+bool linkRuntime(llvm::Module &module);
+
+#endif // MILA_RUNTIME_HPP
@@ -0,0 +1,109 @@
+#include "ServerProtocol.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// A source file or an object never gets near this, anything larger is a corrupted stream
+const std::uint32_t MaxStringSize = 1u << 30;
+
+bool writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool readAll(int fd, char *data, size_t size) {
+    while (size > 0) {
+        ssize_t got = ::read(fd, data, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        data += got;
+        size -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+void putU32(std::string &out, std::uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+bool readU32(int fd, std::uint32_t &value) {
+    unsigned char bytes[4];
+    if (!readAll(fd, reinterpret_cast<char *>(bytes), sizeof(bytes)))
+        return false;
+    value = 0;
+    for (int i = 0; i < 4; i++)
+        value |= static_cast<std::uint32_t>(bytes[i]) << (8 * i);
+    return true;
+}
+
+}
+
+std::string server::defaultSocketPath() {
+    if (const char *path = std::getenv("MILA_SERVER_SOCKET"))
+        return path;
+    const char *dir = std::getenv("XDG_RUNTIME_DIR");
+    return std::string(dir ? dir : "/tmp") + "/mila-" + std::to_string(::getuid()) + ".sock";
+}
+
+bool server::sendMessage(int fd, const std::vector<std::string> &message) {
+    std::string data;
+    putU32(data, static_cast<std::uint32_t>(message.size()));
+    for (const std::string &part : message) {
+        putU32(data, static_cast<std::uint32_t>(part.size()));
+        data += part;
+    }
+    return writeAll(fd, data.data(), data.size());
+}
+
+bool server::receiveMessage(int fd, std::vector<std::string> &message) {
+    std::uint32_t count;
+    if (!readU32(fd, count))
+        return false;
+    message.clear();
+    for (; count > 0; count--) {
+        std::uint32_t size;
+        if (!readU32(fd, size) || size > MaxStringSize)
+            return false;
+        std::string part(size, '\0');
+        if (!readAll(fd, &part[0], size))
+            return false;
+        message.push_back(std::move(part));
+    }
+    return true;
+}
+
+int server::connectTo(const std::string &path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path))
+        return -1;
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,28 @@
+#ifndef MILA_SERVERPROTOCOL_HPP
+#define MILA_SERVERPROTOCOL_HPP
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Messages between the compile server (mila --serve) and mila-client over a Unix domain socket.
+ *
+ * A message is a list of strings: a 32-bit little-endian count, then every string as a 32-bit length and its
+ * bytes. A request is {command, working directory, arguments..., source}, the reply {status, stdout, stderr}.
+ * Commands are "compile" and "shutdown". Shared by both programs, so it must not depend on LLVM.
+ */
+namespace server {
+
+/// Where the server listens unless told otherwise: $MILA_SERVER_SOCKET, else a per-user socket in the runtime dir.
+std::string defaultSocketPath();
+
+/// Both return false when the peer hung up or the message is malformed.
+bool sendMessage(int fd, const std::vector<std::string> &message);
+bool receiveMessage(int fd, std::vector<std::string> &message);
+
+/// Connected socket or -1 when nothing listens at path.
+int connectTo(const std::string &path);
+
+}
+
+#endif // MILA_SERVERPROTOCOL_HPP
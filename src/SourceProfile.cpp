@@ -0,0 +1,67 @@
+#include "SourceProfile.hpp"
+
+namespace {
+
+// struct mila_region of fce.c: name, line, depth, entries, iterations, inclusive, exclusive, next
+llvm::StructType *regionType(llvm::LLVMContext &ctx) {
+    llvm::Type *i8Ptr = llvm::Type::getInt8PtrTy(ctx);
+    llvm::Type *i32 = llvm::Type::getInt32Ty(ctx);
+    llvm::Type *i64 = llvm::Type::getInt64Ty(ctx);
+    return llvm::StructType::get(ctx, {i8Ptr, i32, i32, i64, i64, i64, i64, i8Ptr});
+}
+
+void callRuntime(llvm::IRBuilder<> &builder, llvm::Module &module, const char *name, llvm::Value *region) {
+    llvm::LLVMContext &ctx = module.getContext();
+    llvm::FunctionCallee callee = module.getOrInsertFunction(name, llvm::Type::getVoidTy(ctx),
+            llvm::Type::getInt8PtrTy(ctx));
+    builder.CreateCall(callee, builder.CreatePointerCast(region, llvm::Type::getInt8PtrTy(ctx)));
+}
+
+}
+
+llvm::Value *createProfileRegion(GenContext &gen, const std::string &name, const Position &position) {
+    llvm::Constant *text = llvm::ConstantDataArray::getString(gen.ctx, name);
+    auto *textGlobal = new llvm::GlobalVariable(gen.module, text->getType(), true, llvm::GlobalValue::PrivateLinkage,
+            text, "__mila_region_name");
+    textGlobal->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+
+    llvm::StructType *type = regionType(gen.ctx);
+    llvm::Constant *fields[] = {
+            llvm::ConstantExpr::getPointerCast(textGlobal, llvm::Type::getInt8PtrTy(gen.ctx)),
+            gen.builder.getInt32(position.getLine()),
+            gen.builder.getInt32(0),
+            gen.builder.getInt64(0),
+            gen.builder.getInt64(0),
+            gen.builder.getInt64(0),
+            gen.builder.getInt64(0),
+            llvm::ConstantPointerNull::get(llvm::Type::getInt8PtrTy(gen.ctx)),
+    };
+    return new llvm::GlobalVariable(gen.module, type, false, llvm::GlobalValue::PrivateLinkage,
+            llvm::ConstantStruct::get(type, fields), "__mila_region");
+}
+
+void profileEnter(GenContext &gen, llvm::Value *region) {
+    callRuntime(gen.builder, gen.module, "mila_region_enter", region);
+}
+
+void profileExit(GenContext &gen, llvm::Value *region) {
+    callRuntime(gen.builder, gen.module, "mila_region_exit", region);
+}
+
+void profileIteration(GenContext &gen, llvm::Value *region, llvm::Value *count) {
+    llvm::Value *iterations = gen.builder.CreateStructGEP(regionType(gen.ctx), region, 4, "iterations");
+    llvm::Value *total = gen.builder.CreateLoad(gen.builder.getInt64Ty(), iterations);
+    gen.builder.CreateStore(gen.builder.CreateAdd(total, count ? count : gen.builder.getInt64(1)), iterations);
+}
+
+void profileReturns(llvm::Function &function, llvm::Value *region) {
+    llvm::IRBuilder<> builder(function.getContext());
+    for (llvm::BasicBlock &block : function) {
+        if (auto *ret = llvm::dyn_cast_or_null<llvm::ReturnInst>(block.getTerminator())) {
+            // Nothing may come between a musttail call and its return, the region is left before the call
+            auto *call = llvm::dyn_cast_or_null<llvm::CallInst>(ret->getPrevNode());
+            builder.SetInsertPoint(call && call->isMustTailCall() ? static_cast<llvm::Instruction *>(call) : ret);
+            callRuntime(builder, *function.getParent(), "mila_region_exit", region);
+        }
+    }
+}
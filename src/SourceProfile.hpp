@@ -0,0 +1,25 @@
+#ifndef MILA_SOURCEPROFILE_HPP
+#define MILA_SOURCEPROFILE_HPP
+
+#include <string>
+
+#include "AST.hpp"
+
+/*
+ * Source-level profiling (mila --profile): every routine and every for and while loop is a region the runtime
+ * times with the cycle counter. A region is a global of the program, struct mila_region of fce.c, and
+ * registers itself when it is entered for the first time; the report is printed to stderr at exit.
+ * Entering and leaving are calls into fce.c, loop iterations are counted inline.
+ */
+
+/// New region for the routine or loop starting at position, name says what it is ("gcd", "gcd: while")
+llvm::Value *createProfileRegion(GenContext &gen, const std::string &name, const Position &position);
+void profileEnter(GenContext &gen, llvm::Value *region);
+void profileExit(GenContext &gen, llvm::Value *region);
+/// Counts one iteration, or count (an i64) of them at once
+void profileIteration(GenContext &gen, llvm::Value *region, llvm::Value *count = nullptr);
+/// Leaves the region of the routine before every return, or before the musttail call in front of it. Loops an
+/// exit jumps out of are left by the runtime.
+void profileReturns(llvm::Function &function, llvm::Value *region);
+
+#endif // MILA_SOURCEPROFILE_HPP
@@ -0,0 +1,472 @@
+#include "TestRunner.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Object/SymbolSize.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include "ObjectEmitter.hpp"
+#include "Optimizer.hpp"
+#include "Parser.hpp"
+
+namespace {
+
+/*
+ * The runtime of JIT-executed programs: fce.c with stdin and stdout replaced by the memory of the test
+ * running on the calling thread.
+ */
+
+struct ProgramIO {
+    std::string::const_iterator in;
+    std::string::const_iterator inEnd;
+    std::string out;
+};
+
+thread_local ProgramIO *currentIO = nullptr;
+
+// Same input as scanf("%d"), like in_int of fce.c. Returns false and leaves x alone otherwise.
+bool readInt(int *x) {
+    ProgramIO &io = *currentIO;
+    while (io.in != io.inEnd && std::isspace(static_cast<unsigned char>(*io.in)))
+        ++io.in;
+    bool negative = false;
+    if (io.in != io.inEnd && (*io.in == '-' || *io.in == '+')) {
+        negative = *io.in == '-';
+        ++io.in;
+    }
+    if (io.in == io.inEnd || !std::isdigit(static_cast<unsigned char>(*io.in)))
+        return false;
+    unsigned int value = 0;
+    for (; io.in != io.inEnd && std::isdigit(static_cast<unsigned char>(*io.in)); ++io.in)
+        value = value * 10 + static_cast<unsigned int>(*io.in - '0');
+    *x = negative ? static_cast<int>(0u - value) : static_cast<int>(value);
+    return true;
+}
+
+void jitWriteln(int x) {
+    currentIO->out += std::to_string(x);
+    currentIO->out += '\n';
+}
+
+void jitWrite(int x) {
+    currentIO->out += std::to_string(x);
+}
+
+int jitReadln(int *x) {
+    readInt(x);
+    return 0;
+}
+
+// out_real of fce.c
+std::string formatReal(double x) {
+    char text[32];
+    int length = std::snprintf(text, sizeof(text), "%.15g", x);
+    std::string result(text, static_cast<size_t>(length));
+    if (result.find_first_not_of("-0123456789") == std::string::npos)
+        result += ".0";
+    return result;
+}
+
+void jitWritelnReal(double x) {
+    currentIO->out += formatReal(x);
+    currentIO->out += '\n';
+}
+
+void jitWriteReal(double x) {
+    currentIO->out += formatReal(x);
+}
+
+int jitReadlnReal(double *x) {
+    ProgramIO &io = *currentIO;
+    while (io.in != io.inEnd && std::isspace(static_cast<unsigned char>(*io.in)))
+        ++io.in;
+    std::string text;
+    for (; io.in != io.inEnd && std::strchr("+-0123456789.eE", *io.in) && text.size() < 63; ++io.in)
+        text += *io.in;
+    char *end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    if (end != text.c_str())
+        *x = value;
+    return 0;
+}
+
+// The memory of a test belongs to its thread, parallel loops run sequentially, which prints the same
+void jitParallelFor(int first, int last, void (*body)(int, int, void *), void *env) {
+    if (first <= last)
+        body(first, last, env);
+}
+
+void jitParallelLock() {}
+
+struct Test {
+    std::string name;      // <sample>.runN
+    std::string input;     // path, empty without input
+    std::string expected;  // path
+    std::string error;     // empty when passed
+};
+
+struct Sample {
+    std::string name;
+    std::vector<size_t> tests;
+};
+
+std::string readFile(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("cannot read " + path);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// Names listed in the uses clause, the same lines the mila script looks at
+std::vector<std::string> usedUnits(const std::string &path) {
+    std::vector<std::string> units;
+    std::istringstream source(readFile(path));
+    for (std::string line; std::getline(source, line);) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line.compare(start, 4, "uses") != 0 || line.size() == start + 4
+            || !std::isspace(static_cast<unsigned char>(line[start + 4])))
+            continue;
+        std::istringstream names(line.substr(start + 4, line.find(';') - start - 4));
+        for (std::string name; std::getline(names, name, ',');) {
+            name.erase(0, name.find_first_not_of(" \t"));
+            name.erase(name.find_last_not_of(" \t") + 1);
+            if (!name.empty())
+                units.push_back(name);
+        }
+    }
+    return units;
+}
+
+// Trailing whitespace never counts, the expected output is stripped at both ends (tests/run_test.cmake)
+std::string strip(const std::string &text, bool leading) {
+    const char *space = " \t\n\r\v\f";
+    size_t end = text.find_last_not_of(space);
+    if (end == std::string::npos)
+        return "";
+    size_t begin = leading ? text.find_first_not_of(space) : 0;
+    return text.substr(begin, end + 1 - begin);
+}
+
+// First line that differs, the whole outputs of a long test say little
+std::string describeDifference(const std::string &output, const std::string &expected) {
+    std::istringstream got(output), want(expected);
+    std::string gotLine, wantLine;
+    for (size_t line = 1;; line++) {
+        bool hasGot = static_cast<bool>(std::getline(got, gotLine));
+        bool hasWant = static_cast<bool>(std::getline(want, wantLine));
+        if (!hasGot && !hasWant)
+            return "outputs differ";
+        if (hasGot != hasWant || gotLine != wantLine)
+            return "line " + std::to_string(line) + ": expected " + (hasWant ? "\"" + wantLine + "\"" : "nothing")
+                   + ", got " + (hasGot ? "\"" + gotLine + "\"" : "nothing");
+    }
+}
+
+/*
+ * /tmp/perf-<pid>.map, where perf looks up the names of code in anonymous memory: one line per routine with
+ * its address, size and name, the sample it belongs to in brackets.
+ */
+class PerfMapListener : public llvm::JITEventListener {
+public:
+    PerfMapListener() : m_Map("/tmp/perf-" + std::to_string(::getpid()) + ".map") {}
+
+    void notifyObjectLoaded(ObjectKey, const llvm::object::ObjectFile &object,
+                            const llvm::RuntimeDyld::LoadedObjectInfo &info) override {
+        // The copy for debuggers has the symbols at their load addresses
+        llvm::object::OwningBinary<llvm::object::ObjectFile> loaded = info.getObjectForDebug(object);
+        if (!loaded.getBinary())
+            return;
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (const auto &[symbol, size] : llvm::object::computeSymbolSizes(*loaded.getBinary())) {
+            llvm::Expected<llvm::object::SymbolRef::Type> type = symbol.getType();
+            llvm::Expected<llvm::StringRef> name = symbol.getName();
+            llvm::Expected<uint64_t> address = symbol.getAddress();
+            if (!type || !name || !address || *type != llvm::object::SymbolRef::ST_Function || size == 0) {
+                llvm::consumeError(type.takeError());
+                llvm::consumeError(name.takeError());
+                llvm::consumeError(address.takeError());
+                continue;
+            }
+            m_Map << std::hex << *address << " " << size << std::dec << " " << name->str() << " ["
+                  << object.getFileName().str() << "]\n";
+        }
+        m_Map.flush();
+    }
+
+private:
+    std::ofstream m_Map;
+    std::mutex m_Mutex;
+};
+
+class Runner {
+public:
+    explicit Runner(const TestRunOptions &options) : m_Options(options) {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        llvm::orc::LLJITBuilder builder;
+        if (options.perf) {
+            // Names for perf report right away, and a jitdump with line tables for perf inject --jit
+            m_PerfMap = std::make_unique<PerfMapListener>();
+            m_PerfDump = llvm::JITEventListener::createPerfJITEventListener();
+            builder.setObjectLinkingLayerCreator([this](llvm::orc::ExecutionSession &session, const llvm::Triple &) {
+                auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(session,
+                        [] { return std::make_unique<llvm::SectionMemoryManager>(); });
+                layer->registerJITEventListener(*m_PerfMap);
+                if (m_PerfDump)
+                    layer->registerJITEventListener(*m_PerfDump);
+                return llvm::Expected<std::unique_ptr<llvm::orc::ObjectLayer>>(std::move(layer));
+            });
+        }
+        m_Jit = check(builder.create());
+
+        llvm::orc::ExecutionSession &session = m_Jit->getExecutionSession();
+        m_Runtime = &session.createBareJITDylib("runtime");
+        llvm::orc::MangleAndInterner mangle(session, m_Jit->getDataLayout());
+        check(m_Runtime->define(llvm::orc::absoluteSymbols({
+                {mangle("writeln"), llvm::JITEvaluatedSymbol::fromPointer(&jitWriteln)},
+                {mangle("write"), llvm::JITEvaluatedSymbol::fromPointer(&jitWrite)},
+                {mangle("readln"), llvm::JITEvaluatedSymbol::fromPointer(&jitReadln)},
+                {mangle("writeln_real"), llvm::JITEvaluatedSymbol::fromPointer(&jitWritelnReal)},
+                {mangle("write_real"), llvm::JITEvaluatedSymbol::fromPointer(&jitWriteReal)},
+                {mangle("readln_real"), llvm::JITEvaluatedSymbol::fromPointer(&jitReadlnReal)},
+                {mangle("mila_parallel_for"), llvm::JITEvaluatedSymbol::fromPointer(&jitParallelFor)},
+                {mangle("mila_parallel_lock"), llvm::JITEvaluatedSymbol::fromPointer(&jitParallelLock)},
+                {mangle("mila_parallel_unlock"), llvm::JITEvaluatedSymbol::fromPointer(&jitParallelLock)},
+        })));
+        // Whatever else the code generator calls (memset, ...)
+        m_Runtime->addGenerator(check(llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+                m_Jit->getDataLayout().getGlobalPrefix())));
+
+        m_Units = &session.createBareJITDylib("units");
+        m_Units->addToLinkOrder(*m_Runtime);
+
+        std::error_code ec;
+        m_InterfaceDir = std::filesystem::temp_directory_path(ec) / ("mila-tests-" + std::to_string(::getpid()));
+        std::filesystem::create_directories(m_InterfaceDir, ec);
+        if (ec)
+            throw std::runtime_error("Cannot create " + m_InterfaceDir.string() + ": " + ec.message());
+    }
+
+    ~Runner() {
+        std::error_code ec;
+        std::filesystem::remove_all(m_InterfaceDir, ec);
+    }
+
+    // Units are few and shared by the samples, they are compiled up front in one thread
+    void buildUnits(const std::vector<Sample> &samples, std::vector<Test> &tests) {
+        for (const Sample &sample : samples) {
+            try {
+                for (const std::string &unit : usedUnits(sourcePath(sample.name)))
+                    buildUnit(unit);
+            } catch (const std::exception &e) {
+                for (size_t test : sample.tests)
+                    tests[test].error = e.what();
+            }
+        }
+    }
+
+    void runSample(const Sample &sample, std::vector<Test> &tests) {
+        llvm::orc::ExecutionSession &session = m_Jit->getExecutionSession();
+        llvm::orc::JITDylib *program = nullptr;
+        try {
+            llvm::SmallVector<char, 0> object;
+            compile(sourcePath(sample.name), "", object);
+            program = &session.createBareJITDylib(sample.name);
+            program->addToLinkOrder(*m_Units);
+            program->addToLinkOrder(*m_Runtime);
+            check(m_Jit->addObjectFile(*program, llvm::MemoryBuffer::getMemBufferCopy(
+                    llvm::StringRef(object.data(), object.size()), sample.name)));
+            auto main = check(m_Jit->lookup(*program, "main")).getAddress();
+
+            // Variables live in the frame of main, so every call starts from scratch
+            for (size_t index : sample.tests) {
+                Test &test = tests[index];
+                try {
+                    runTest(reinterpret_cast<int (*)()>(main), test);
+                } catch (const std::exception &e) {
+                    test.error = e.what();
+                }
+            }
+        } catch (const std::exception &e) {
+            for (size_t test : sample.tests)
+                if (tests[test].error.empty())
+                    tests[test].error = e.what();
+        }
+        // Under perf the code stays, so that no address ever belongs to two routines
+        if (program && !m_Options.perf)
+            llvm::consumeError(session.removeJITDylib(*program));
+    }
+
+private:
+    template<typename T>
+    static T check(llvm::Expected<T> value) {
+        if (!value)
+            throw std::runtime_error(llvm::toString(value.takeError()));
+        return std::move(*value);
+    }
+
+    static void check(llvm::Error error) {
+        if (error)
+            throw std::runtime_error(llvm::toString(std::move(error)));
+    }
+
+    std::string sourcePath(const std::string &name) const {
+        return m_Options.sampleDir + "/" + name + ".mila";
+    }
+
+    void compile(const std::string &path, const std::string &interfaceFile, llvm::SmallVector<char, 0> &object) {
+        std::ifstream source(path);
+        if (!source)
+            throw std::runtime_error("cannot open " + path);
+
+        Parser parser(source);
+        parser.addInterfaceDir(m_InterfaceDir.string());
+        if (!interfaceFile.empty())
+            parser.setInterfaceFile(interfaceFile);
+        parser.setLinkRuntime(false);
+        // Line tables of the jitdump come from the DWARF, which leaves the code as it is
+        if (m_Options.perf)
+            parser.setDebugInfo(std::filesystem::absolute(path).string());
+        if (!parser.Parse())
+            throw std::runtime_error("parsing " + path + " failed");
+        llvm::Module &module = parser.Generate();
+        optimizeModule(module, m_Options.optLevel);
+        emitObject(module, object);
+    }
+
+    void buildUnit(const std::string &name) {
+        auto state = m_UnitState.find(name);
+        if (state != m_UnitState.end()) {
+            if (!state->second)
+                throw std::runtime_error("circular unit reference through " + name);
+            return;
+        }
+        std::string path = sourcePath(name);
+        if (!std::filesystem::exists(path))
+            throw std::runtime_error("unit " + name + " not found: " + path);
+        m_UnitState[name] = false;
+        for (const std::string &unit : usedUnits(path))
+            buildUnit(unit);
+
+        llvm::SmallVector<char, 0> object;
+        compile(path, (m_InterfaceDir / (name + ".mili")).string(), object);
+        check(m_Jit->addObjectFile(*m_Units, llvm::MemoryBuffer::getMemBufferCopy(
+                llvm::StringRef(object.data(), object.size()), name)));
+        m_UnitState[name] = true;
+    }
+
+    static void runTest(int (*main)(), Test &test) {
+        std::string input = test.input.empty() ? std::string() : readFile(test.input);
+        ProgramIO io{input.cbegin(), input.cend(), {}};
+        currentIO = &io;
+        int status = main();
+        currentIO = nullptr;
+        if (status != 0) {
+            test.error = "exit code " + std::to_string(status);
+            return;
+        }
+
+        std::string output = strip(io.out, false);
+        std::string expected = strip(readFile(test.expected), true);
+        if (output != expected)
+            test.error = describeDifference(output, expected);
+    }
+
+    const TestRunOptions &m_Options;
+    std::unique_ptr<PerfMapListener> m_PerfMap;
+    llvm::JITEventListener *m_PerfDump = nullptr;  // owned by LLVM
+    std::unique_ptr<llvm::orc::LLJIT> m_Jit;
+    llvm::orc::JITDylib *m_Runtime = nullptr;
+    llvm::orc::JITDylib *m_Units = nullptr;
+    std::filesystem::path m_InterfaceDir;
+    std::map<std::string, bool> m_UnitState;  // false while its dependencies are being built
+};
+
+}
+
+size_t runTestDir(const TestRunOptions &options) {
+    auto start = std::chrono::steady_clock::now();
+
+    // <sample>.runN.out, in name order so that the report reads the same every time
+    std::vector<Test> tests;
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(options.testDir, ec)) {
+        std::string file = entry.path().filename().string();
+        size_t run = file.rfind(".run");
+        if (file.size() < 4 || file.compare(file.size() - 4, 4, ".out") != 0 || run == std::string::npos || run == 0
+            || run + 4 >= file.size() - 4
+            || !std::all_of(file.begin() + run + 4, file.end() - 4, [](char c) { return std::isdigit(c); }))
+            continue;
+        Test test;
+        test.name = file.substr(0, file.size() - 4);
+        test.expected = entry.path().string();
+        std::string input = options.testDir + "/" + test.name + ".in";
+        if (std::filesystem::exists(input))
+            test.input = input;
+        tests.push_back(test);
+    }
+    if (ec) {
+        std::cerr << "Cannot read " << options.testDir << ": " << ec.message() << std::endl;
+        return 1;
+    }
+    std::sort(tests.begin(), tests.end(), [](const Test &a, const Test &b) { return a.name < b.name; });
+
+    std::vector<Sample> samples;
+    for (size_t i = 0; i < tests.size(); i++) {
+        std::string name = tests[i].name.substr(0, tests[i].name.rfind(".run"));
+        if (samples.empty() || samples.back().name != name)
+            samples.push_back({name, {}});
+        samples.back().tests.push_back(i);
+    }
+
+    Runner runner(options);
+    runner.buildUnits(samples, tests);
+
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < samples.size(); i = next++)
+            runner.runSample(samples[i], tests);
+    };
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < std::max(1u, options.jobs); t++)
+        threads.emplace_back(worker);
+    for (std::thread &thread : threads)
+        thread.join();
+
+    size_t failed = 0;
+    for (const Test &test : tests) {
+        if (test.error.empty())
+            continue;
+        std::cout << "FAIL " << test.name << ": " << test.error << "\n";
+        failed++;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Tests: " << tests.size() - failed << " of " << tests.size() << " passed, " << failed
+              << " failed (" << std::fixed << std::setprecision(2) << elapsed.count() << " s)" << std::endl;
+    return failed;
+}
@@ -0,0 +1,33 @@
+#ifndef MILA_TESTRUNNER_HPP
+#define MILA_TESTRUNNER_HPP
+
+#include <string>
+
+struct TestRunOptions {
+    std::string testDir;
+    std::string sampleDir = "samples";
+    unsigned optLevel = 0;
+    unsigned jobs = 1;
+    // Registers the JIT-compiled routines with perf, see runTestDir
+    bool perf = false;
+};
+
+/**
+ * @brief Runs the golden-output tests of testDir without leaving the process.
+ *
+ * Every <name>.runN.out (with the optional <name>.runN.in as input) is a test of <sampleDir>/<name>.mila, the same
+ * pairs ctest runs. Each sample is compiled once, loaded into a JIT and its main is called for every test on a
+ * thread of the pool, with writeln, write and readln working on memory instead of stdout and stdin. Units the
+ * samples use are compiled from sampleDir as well. The output is compared like tests/run_test.cmake does, failures
+ * are listed on stdout followed by a summary. Returns the number of failed tests.
+ *
+ * With perf set, every routine loaded gets a line in /tmp/perf-<pid>.map, so that perf report names the JIT-compiled
+ * code, and a jitdump record with its source lines ($JITDUMPDIR, by default ~/.debug/jit) for perf record -k 1 and
+ * perf inject --jit.
+ *
+ * A test that crashes takes the runner with it, and one that never ends keeps it waiting, ctest is the place to
+ * look into such programs.
+ */
+size_t runTestDir(const TestRunOptions &options);
+
+#endif // MILA_TESTRUNNER_HPP
@@ -0,0 +1,170 @@
+#include "TimeReport.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+
+#include "MemoryReport.hpp"
+
+namespace {
+
+thread_local TimeReport::Scope *t_Innermost = nullptr;
+
+std::string jsonString(const std::string &text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+std::string milliseconds(double seconds) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.3f", seconds * 1000);
+    return buffer;
+}
+
+}
+
+TimeReport::Scope::Scope(TimeReport *report, const char *phase)
+    : m_Report(report), m_Phase(phase), m_Outer(nullptr), m_Wall(0), m_Cpu(0) {
+    if (MemoryReport::enabled())
+        m_MemoryOuter = MemoryReport::enterPhase(phase);
+    if (!m_Report)
+        return;
+    m_Outer = t_Innermost;
+    t_Innermost = this;
+    m_Wall = wallTime();
+    m_Cpu = cpuTime();
+}
+
+TimeReport::Scope::~Scope() {
+    if (m_MemoryOuter >= 0)
+        MemoryReport::leavePhase(m_MemoryOuter);
+    if (!m_Report)
+        return;
+    double wall = wallTime() - m_Wall;
+    double cpu = cpuTime() - m_Cpu;
+    t_Innermost = m_Outer;
+    if (m_Outer) {
+        m_Outer->m_InnerWall += wall;
+        m_Outer->m_InnerCpu += cpu;
+    }
+    m_Report->addPhase(m_Phase, wall - m_InnerWall, cpu - m_InnerCpu);
+}
+
+double TimeReport::wallTime() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double TimeReport::cpuTime() {
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void TimeReport::add(std::vector<Entry> &entries, const std::string &name, double wall, double cpu) {
+    auto entry = std::find_if(entries.begin(), entries.end(), [&name](const Entry &e) { return e.name == name; });
+    if (entry == entries.end()) {
+        entries.push_back({name});
+        entry = entries.end() - 1;
+    }
+    entry->wall += wall;
+    entry->cpu += cpu;
+    entry->calls++;
+}
+
+void TimeReport::addPhase(const std::string &phase, double wall, double cpu) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    add(m_Phases, phase, wall, cpu);
+}
+
+void TimeReport::addPass(const std::string &pass, double wall, double cpu) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    add(m_Passes, pass, wall, cpu);
+}
+
+void TimeReport::addCount(const std::string &name, std::uint64_t value) {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for (auto &count : m_Counts) {
+        if (count.first == name) {
+            count.second += value;
+            return;
+        }
+    }
+    m_Counts.emplace_back(name, value);
+}
+
+void TimeReport::addModuleCounts(const llvm::Module &module, const std::string &stage) {
+    std::uint64_t functions = 0, instructions = 0;
+    for (const llvm::Function &F : module) {
+        if (F.isDeclaration())
+            continue;
+        functions++;
+        instructions += F.getInstructionCount();
+    }
+    addCount("IR functions (" + stage + ")", functions);
+    addCount("IR instructions (" + stage + ")", instructions);
+}
+
+void TimeReport::printTable(std::ostream &out) const {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto section = [&out](const char *title, std::vector<Entry> entries) {
+        if (entries.empty())
+            return;
+        double wall = 0, cpu = 0;
+        for (const Entry &entry : entries) {
+            wall += entry.wall;
+            cpu += entry.cpu;
+        }
+        std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.wall > b.wall; });
+        char line[160];
+        out << "===--- " << title << " ---===\n";
+        std::snprintf(line, sizeof(line), "%12s %7s %12s %10s  %s\n", "wall ms", "wall %", "cpu ms", "calls", "name");
+        out << line;
+        for (const Entry &entry : entries) {
+            std::snprintf(line, sizeof(line), "%12s %6.1f%% %12s %10llu  ", milliseconds(entry.wall).c_str(),
+                          wall > 0 ? 100 * entry.wall / wall : 0.0, milliseconds(entry.cpu).c_str(),
+                          static_cast<unsigned long long>(entry.calls));
+            out << line << entry.name << "\n";
+        }
+        std::snprintf(line, sizeof(line), "%12s %6.1f%% %12s %10s  ", milliseconds(wall).c_str(), 100.0,
+                      milliseconds(cpu).c_str(), "");
+        out << line << "total\n\n";
+    };
+    section("Compilation phases", m_Phases);
+    section("LLVM passes", m_Passes);
+    if (!m_Counts.empty()) {
+        out << "===--- Counts ---===\n";
+        for (const auto &count : m_Counts) {
+            char line[64];
+            std::snprintf(line, sizeof(line), "%12llu  ", static_cast<unsigned long long>(count.second));
+            out << line << count.first << "\n";
+        }
+    }
+    out.flush();
+}
+
+void TimeReport::printJson(std::ostream &out) const {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto entries = [&out](const std::vector<Entry> &list) {
+        out << "[";
+        for (size_t i = 0; i < list.size(); i++) {
+            out << (i ? ",\n    " : "\n    ") << "{\"name\": " << jsonString(list[i].name)
+                << ", \"wall_ms\": " << milliseconds(list[i].wall) << ", \"cpu_ms\": " << milliseconds(list[i].cpu)
+                << ", \"calls\": " << list[i].calls << "}";
+        }
+        out << (list.empty() ? "]" : "\n  ]");
+    };
+    out << "{\n  \"phases\": ";
+    entries(m_Phases);
+    out << ",\n  \"passes\": ";
+    entries(m_Passes);
+    out << ",\n  \"counts\": {";
+    for (size_t i = 0; i < m_Counts.size(); i++)
+        out << (i ? ", " : "") << jsonString(m_Counts[i].first) << ": " << m_Counts[i].second;
+    out << "}\n}" << std::endl;
+}
@@ -0,0 +1,69 @@
+#ifndef MILA_TIMEREPORT_HPP
+#define MILA_TIMEREPORT_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <llvm/IR/Module.h>
+
+/**
+ * @brief Wall and CPU time spent in the phases of a compilation and in the LLVM passes, plus size counters.
+ *
+ * Collected when the compiler runs with --time-report and printed at the end, as a table or as JSON. CPU time is
+ * the time of the whole process, so phases running on several threads (-j) count the work of all of them.
+ * Recording is thread-safe.
+ */
+class TimeReport {
+public:
+    /**
+     * @brief Times a phase from construction to destruction, does nothing without a report.
+     *
+     * Scopes nest per thread: the time of an inner scope is not counted again in the outer one, so every phase
+     * shows the time spent in it alone. With --mem-report the scope is also the phase allocations count towards.
+     */
+    class Scope {
+    public:
+        Scope(TimeReport *report, const char *phase);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        TimeReport *m_Report;
+        const char *m_Phase;
+        Scope *m_Outer;
+        double m_Wall, m_Cpu;
+        double m_InnerWall = 0, m_InnerCpu = 0;
+        int m_MemoryOuter = -1;
+    };
+
+    void addPhase(const std::string &phase, double wall, double cpu);
+    void addPass(const std::string &pass, double wall, double cpu);
+    void addCount(const std::string &name, std::uint64_t value);
+    /// Counts the defined functions and the instructions of module, stage says when ("generated", "optimised")
+    void addModuleCounts(const llvm::Module &module, const std::string &stage);
+
+    void printTable(std::ostream &out) const;
+    void printJson(std::ostream &out) const;
+
+    /// Seconds since an arbitrary point, for callers timing intervals themselves
+    static double wallTime();
+    static double cpuTime();
+
+private:
+    struct Entry {
+        std::string name;
+        double wall = 0, cpu = 0;
+        std::uint64_t calls = 0;
+    };
+    static void add(std::vector<Entry> &entries, const std::string &name, double wall, double cpu);
+
+    mutable std::mutex m_Mutex;
+    std::vector<Entry> m_Phases, m_Passes;
+    std::vector<std::pair<std::string, std::uint64_t>> m_Counts;
+};
+
+#endif // MILA_TIMEREPORT_HPP
@@ -0,0 +1,126 @@
+#include "UnitInterface.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+const char Magic[4] = {'M', 'I', 'L', 'I'};
+// Bump whenever the layout changes, stale interfaces are then rejected instead of misread
+const std::uint32_t FormatVersion = 2;
+
+void putU32(std::string &out, std::uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+void putString(std::string &out, const std::string &value) {
+    putU32(out, static_cast<std::uint32_t>(value.size()));
+    out += value;
+}
+
+class Reader {
+public:
+    Reader(std::string data, const std::string &path) : m_Data(std::move(data)), m_Path(path) {}
+
+    std::uint32_t u32() {
+        need(4);
+        std::uint32_t value = 0;
+        for (int i = 0; i < 4; i++)
+            value |= static_cast<std::uint32_t>(static_cast<unsigned char>(m_Data[m_Pos++])) << (8 * i);
+        return value;
+    }
+
+    std::string string() {
+        std::uint32_t size = u32();
+        need(size);
+        std::string value = m_Data.substr(m_Pos, size);
+        m_Pos += size;
+        return value;
+    }
+
+    bool atEnd() const { return m_Pos == m_Data.size(); }
+
+private:
+    void need(std::size_t size) {
+        if (m_Data.size() - m_Pos < size)
+            throw std::runtime_error("Truncated unit interface: " + m_Path);
+    }
+
+    std::string m_Data;
+    const std::string &m_Path;
+    std::size_t m_Pos = 0;
+};
+
+std::string readFile(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return {};
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+}
+
+void UnitInterface::write(const std::string &path) const {
+    std::string data(Magic, sizeof(Magic));
+    putU32(data, FormatVersion);
+    putString(data, name);
+    putU32(data, static_cast<std::uint32_t>(constants.size()));
+    for (const auto &constant : constants) {
+        putString(data, constant.first);
+        putU32(data, static_cast<std::uint32_t>(constant.second));
+    }
+    putU32(data, static_cast<std::uint32_t>(routines.size()));
+    for (const Routine &routine : routines) {
+        putString(data, routine.name);
+        // Bit 0: procedure, bit 1: the result is real
+        putU32(data, (routine.procedure ? 1 : 0) | (routine.realResult ? 2 : 0));
+        putU32(data, static_cast<std::uint32_t>(routine.args.size()));
+        for (size_t i = 0; i < routine.args.size(); i++) {
+            putString(data, routine.args[i]);
+            putU32(data, i < routine.realArgs.size() && routine.realArgs[i] ? 1 : 0);
+        }
+    }
+
+    if (readFile(path) == data)
+        return;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!out)
+        throw std::runtime_error("Cannot write unit interface: " + path);
+}
+
+UnitInterface UnitInterface::read(const std::string &path) {
+    std::string data = readFile(path);
+    if (data.size() < sizeof(Magic) || data.compare(0, sizeof(Magic), Magic, sizeof(Magic)) != 0)
+        throw std::runtime_error("Not a unit interface: " + path);
+
+    Reader reader(data.substr(sizeof(Magic)), path);
+    if (reader.u32() != FormatVersion)
+        throw std::runtime_error("Unit interface from another compiler version: " + path);
+
+    UnitInterface result;
+    result.name = reader.string();
+    for (std::uint32_t count = reader.u32(); count > 0; count--) {
+        std::string constant = reader.string();
+        result.constants.emplace_back(constant, static_cast<int>(reader.u32()));
+    }
+    for (std::uint32_t count = reader.u32(); count > 0; count--) {
+        Routine routine;
+        routine.name = reader.string();
+        std::uint32_t flags = reader.u32();
+        routine.procedure = (flags & 1) != 0;
+        routine.realResult = (flags & 2) != 0;
+        for (std::uint32_t args = reader.u32(); args > 0; args--) {
+            routine.args.push_back(reader.string());
+            routine.realArgs.push_back(reader.u32() != 0);
+        }
+        result.routines.push_back(std::move(routine));
+    }
+    if (!reader.atEnd())
+        throw std::runtime_error("Trailing data in unit interface: " + path);
+    return result;
+}
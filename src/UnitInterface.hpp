@@ -0,0 +1,35 @@
+#ifndef MILA_UNITINTERFACE_HPP
+#define MILA_UNITINTERFACE_HPP
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief What importers need to know about a compiled unit: its exported routines and constants.
+ *
+ * Written next to the unit object when the unit is compiled and read instead of the unit source by every
+ * program or unit that uses it. The file is binary: magic and format version, then length-prefixed names and
+ * little-endian 32-bit numbers.
+ */
+struct UnitInterface {
+    struct Routine {
+        std::string name;
+        std::vector<std::string> args;
+        std::vector<bool> realArgs;
+        bool procedure;
+        bool realResult = false;
+    };
+
+    std::string name;
+    std::vector<std::pair<std::string, int>> constants;
+    std::vector<Routine> routines;
+
+    /// An existing file with the same content is left untouched, so its timestamp only moves
+    /// when the importers really have to be recompiled.
+    void write(const std::string &path) const;
+    /// Throws std::runtime_error when the file is missing or is not an interface this compiler can read.
+    static UnitInterface read(const std::string &path);
+};
+
+#endif // MILA_UNITINTERFACE_HPP
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <climits>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "CompilerOptions.hpp"
+#include "ServerProtocol.hpp"
+
+/*
+ * Thin front end of the compile server: takes the arguments of build/mila and the source on stdin, has the server
+ * compile it and prints what the compiler would have printed. Without a running server, and for the modes the
+ * server does not do (batches, tests, --mem-report), it becomes build/mila itself, so callers never have to care
+ * whether a server is up. Deliberately free of LLVM, it starts in no time.
+ *
+ *   mila-client [--socket PATH] [compiler arguments...] < source
+ *   mila-client [--socket PATH] --shutdown
+ */
+
+namespace {
+
+/// Replaces this process with the compiler next to the client
+int compileInProcess(const std::vector<std::string> &args) {
+    char self[PATH_MAX];
+    ssize_t size = ::readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (size < 0) {
+        std::cerr << "mila-client: cannot locate the compiler" << std::endl;
+        return 1;
+    }
+    std::string compiler(self, static_cast<size_t>(size));
+    compiler = compiler.substr(0, compiler.find_last_of('/') + 1) + "mila";
+
+    std::vector<char *> argv{&compiler[0]};
+    for (const std::string &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    ::execv(compiler.c_str(), argv.data());
+    std::cerr << "mila-client: cannot run " << compiler << std::endl;
+    return 1;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    std::string socketPath = server::defaultSocketPath();
+    bool shutdown = false;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (arg == "--shutdown")
+            shutdown = true;
+        else
+            args.push_back(arg);
+    }
+
+    // Errors in the arguments are reported by the compiler
+    bool servable = false;
+    try {
+        servable = parseCompilerOptions(args).servable();
+    } catch (const std::exception &) {
+    }
+    if (!servable && !shutdown)
+        return compileInProcess(args);
+
+    int fd = server::connectTo(socketPath);
+    if (fd < 0) {
+        if (shutdown) {
+            std::cerr << "mila-client: no compile server on " << socketPath << std::endl;
+            return 1;
+        }
+        return compileInProcess(args);
+    }
+
+    std::vector<std::string> request;
+    if (shutdown) {
+        request = {"shutdown"};
+    } else {
+        char cwd[PATH_MAX];
+        request = {"compile", ::getcwd(cwd, sizeof(cwd)) ? cwd : "/"};
+        request.insert(request.end(), args.begin(), args.end());
+        request.emplace_back(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    }
+
+    std::vector<std::string> reply;
+    if (!server::sendMessage(fd, request) || !server::receiveMessage(fd, reply) || reply.size() != 3) {
+        std::cerr << "mila-client: the compile server on " << socketPath << " did not answer" << std::endl;
+        return 1;
+    }
+    ::close(fd);
+    std::cout << reply[1];
+    std::cerr << reply[2];
+    return std::atoi(reply[0].c_str());
+}
@@ -1,14 +1,726 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
-int writeln(int x) {
-    printf("%d\n", x);
-    return 0;
+/* <unistd.h> declares write(2), which would clash with the Mila write below */
+#define write posix_write
+#include <unistd.h>
+#undef write
+
+/*
+ * Output is collected in one large buffer and handed to stdio in a single call only when the buffer
+ * fills up, before reading input (so prompts show up before the program blocks) and at exit.
+ * When stdout is a terminal every line is flushed as it is completed.
+ */
+
+#define OUT_BUFFER_SIZE (1 << 16)
+/* longest formatted int: sign, 10 digits and the newline */
+#define INT_MAX_CHARS 12
+/* longest formatted real: sign, 17 digits, point, exponent "e-308", the ".0" suffix and the newline */
+#define REAL_MAX_CHARS 32
+
+static char out_buffer[OUT_BUFFER_SIZE];
+static size_t out_len = 0;
+static int out_initialized = 0;
+static int out_line_buffered = 0;
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static void out_flush(void) {
+    if (!out_len)
+        return;
+    fwrite(out_buffer, 1, out_len, stdout);
+    out_len = 0;
+    fflush(stdout);
 }
-int write(int x) {
-    printf("%d", x);
-    return 0;
+
+static void out_init(void) {
+    out_initialized = 1;
+    out_line_buffered = isatty(fileno(stdout));
+    atexit(out_flush);
+}
+
+/* Formats x right-aligned so that it ends just before end, two digits per step. Returns the first char. */
+static char *format_int(char *end, int x) {
+    unsigned int v = x < 0 ? 0u - (unsigned int) x : (unsigned int) x;
+    while (v >= 100) {
+        unsigned int r = v % 100;
+        v /= 100;
+        end -= 2;
+        memcpy(end, digit_pairs + 2 * r, 2);
+    }
+    if (v >= 10) {
+        end -= 2;
+        memcpy(end, digit_pairs + 2 * v, 2);
+    } else {
+        *--end = (char) ('0' + v);
+    }
+    if (x < 0)
+        *--end = '-';
+    return end;
+}
+
+/* Output and input inside the body of a parallel loop, see Parallel loops below */
+struct par_worker;
+/* Worker the thread runs a body for, null outside of parallel loops */
+static _Thread_local struct par_worker *par_self = NULL;
+static int par_append(const char *begin, size_t len);
+static void par_input_lock(void);
+static void par_input_unlock(void);
+
+static void out_append(const char *begin, size_t len, int newline) {
+    if (par_append(begin, len))
+        return;
+    if (!out_initialized)
+        out_init();
+    if (out_len + len > OUT_BUFFER_SIZE)
+        out_flush();
+    memcpy(out_buffer + out_len, begin, len);
+    out_len += len;
+    if (newline && out_line_buffered)
+        out_flush();
+}
+
+static void out_int(int x, int newline) {
+    char tmp[INT_MAX_CHARS];
+    char *end = tmp + sizeof(tmp);
+    if (newline)
+        end[-1] = '\n';
+    char *begin = format_int(end - newline, x);
+    out_append(begin, (size_t) (end - begin), newline);
+}
+
+/* Shortest of up to 15 significant digits, a real always shows a point or exponent so it never reads as an int */
+static void out_real(double x, int newline) {
+    char tmp[REAL_MAX_CHARS];
+    int len = snprintf(tmp, sizeof(tmp) - 3, "%.15g", x);
+    if (strspn(tmp, "-0123456789") == (size_t) len) {
+        memcpy(tmp + len, ".0", 2);
+        len += 2;
+    }
+    if (newline)
+        tmp[len++] = '\n';
+    out_append(tmp, (size_t) len, newline);
+}
+
+/*
+ * Input is scanned by hand straight from memory. A regular file on stdin is mapped as a whole,
+ * anything else (pipes, terminals) is read(2) in large blocks, each read returning whatever is available.
+ */
+
+#define IN_BUFFER_SIZE (1 << 16)
+
+static char in_buffer[IN_BUFFER_SIZE];
+static const char *in_pos = NULL;
+static const char *in_end = NULL;
+static int in_initialized = 0;
+static int in_mapped = 0;
+
+static void in_init(void) {
+    int fd = fileno(stdin);
+    struct stat st;
+    in_initialized = 1;
+    in_pos = in_end = in_buffer;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return;
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0 || offset >= st.st_size)
+        return;
+    const char *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return;
+    in_mapped = 1;
+    in_pos = map + offset;
+    in_end = map + st.st_size;
+}
+
+/* Returns 0 at the end of input */
+static int in_refill(void) {
+    if (in_mapped)
+        return 0;
+    ssize_t n;
+    do {
+        n = read(fileno(stdin), in_buffer, IN_BUFFER_SIZE);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return 0;
+    in_pos = in_buffer;
+    in_end = in_buffer + n;
+    return 1;
+}
+
+static inline int in_peek(void) {
+    if (in_pos == in_end && !in_refill())
+        return EOF;
+    return (unsigned char) *in_pos;
+}
+
+/* Same input as scanf("%d"): leading whitespace, optional sign, digits. Returns 0 and leaves x alone otherwise. */
+static int in_int(int *x) {
+    if (!in_initialized)
+        in_init();
+    int c = in_peek();
+    while (c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f') {
+        in_pos++;
+        c = in_peek();
+    }
+    int negative = 0;
+    if (c == '-' || c == '+') {
+        negative = c == '-';
+        in_pos++;
+        c = in_peek();
+    }
+    if (c < '0' || c > '9')
+        return 0;
+    unsigned int v = 0;
+    do {
+        v = v * 10 + (unsigned int) (c - '0');
+        in_pos++;
+        c = in_peek();
+    } while (c >= '0' && c <= '9');
+    *x = negative ? (int) (0u - v) : (int) v;
+    return 1;
+}
+
+void writeln(int x) {
+    out_int(x, 1);
+}
+void write(int x) {
+    out_int(x, 0);
 }
 int readln(int *x) {
-    scanf("%d", x);
+    par_input_lock();
+    out_flush();
+    in_int(x);
+    par_input_unlock();
     return 0;
 }
+void writeln_real(double x) {
+    out_real(x, 1);
+}
+void write_real(double x) {
+    out_real(x, 0);
+}
+/* Same input as scanf("%lf") for decimal numbers: leading whitespace, then a number strtod accepts */
+int readln_real(double *x) {
+    par_input_lock();
+    out_flush();
+    if (!in_initialized)
+        in_init();
+    int c = in_peek();
+    while (c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f') {
+        in_pos++;
+        c = in_peek();
+    }
+    char tmp[REAL_MAX_CHARS * 2];
+    size_t len = 0;
+    while (c != EOF && strchr("+-0123456789.eE", c) && len < sizeof(tmp) - 1) {
+        tmp[len++] = (char) c;
+        in_pos++;
+        c = in_peek();
+    }
+    tmp[len] = '\0';
+    char *end;
+    double value = strtod(tmp, &end);
+    if (end != tmp)
+        *x = value;
+    par_input_unlock();
+    return 0;
+}
+
+/*
+ * Parallel loops (parallel for): the compiler outlines the body into a routine running the iterations first..last,
+ * mila_parallel_for hands the range out in chunks to a pool of threads started on first use, as many as
+ * $MILA_THREADS or the online processors. Every thread owns a part of the range and runs chunks from its front, a
+ * thread that ran out steals the back half of the part of another one. The calling thread works along and returns
+ * when every iteration has run. A parallel loop started from the body of another one runs on the calling thread.
+ *
+ * Output of a body is collected per chunk in a buffer of the thread running it. When the loop is over, the chunks
+ * are appended to the output in the order of their iterations, so the program prints what a sequential loop would.
+ * Reading takes a lock, which iteration gets which input is up to the scheduling.
+ */
+
+#define PAR_MAX_THREADS 256
+/* Chunks per thread the range is cut into: more balance uneven iterations better, fewer cost less stealing */
+#define PAR_CHUNKS_PER_THREAD 8
+
+typedef void (*par_body)(int first, int last, void *env);
+
+/* Output of one chunk, at begin in the text of the thread that ran it */
+struct par_piece {
+    long long first;
+    size_t begin;
+    size_t len;
+};
+
+struct par_worker {
+    /* Iterations still to run, begin << 32 | end as offsets from the first iteration, on a cache line of its own */
+    _Alignas(64) _Atomic unsigned long long range;
+    char *text;
+    size_t text_len, text_cap;
+    struct par_piece *pieces;
+    size_t piece_count, piece_cap;
+};
+
+static struct par_worker par_workers[PAR_MAX_THREADS];
+/* Threads of the pool, the calling thread being the first one; 0 until the pool is started */
+static int par_threads = 0;
+static pthread_mutex_t par_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t par_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t par_done = PTHREAD_COND_INITIALIZER;
+/* Guarded by par_mutex: loops started so far, whether threads may join the current one, and how many did */
+static unsigned long par_generation = 0;
+static int par_open = 0;
+static int par_active = 0;
+/* The current loop, written before it is opened */
+static par_body par_job_body;
+static void *par_job_env;
+static long long par_job_first;
+static unsigned int par_grain;
+/* Iterations not finished yet */
+static _Atomic unsigned int par_remaining;
+static pthread_mutex_t par_reduce_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t par_input_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void par_out_of_memory(void) {
+    fputs("Out of memory in a parallel loop\n", stderr);
+    abort();
+}
+
+static int par_append(const char *begin, size_t len) {
+    struct par_worker *self = par_self;
+    if (!self)
+        return 0;
+    if (self->text_len + len > self->text_cap) {
+        size_t cap = self->text_cap ? 2 * self->text_cap : OUT_BUFFER_SIZE;
+        while (cap < self->text_len + len)
+            cap *= 2;
+        char *text = realloc(self->text, cap);
+        if (!text)
+            par_out_of_memory();
+        self->text = text;
+        self->text_cap = cap;
+    }
+    memcpy(self->text + self->text_len, begin, len);
+    self->text_len += len;
+    return 1;
+}
+
+static void par_input_lock(void) {
+    if (par_self)
+        pthread_mutex_lock(&par_input_mutex);
+}
+
+static void par_input_unlock(void) {
+    if (par_self)
+        pthread_mutex_unlock(&par_input_mutex);
+}
+
+/* Runs the iterations begin..end - 1 of the current loop */
+static void par_run(struct par_worker *self, unsigned int begin, unsigned int end) {
+    size_t mark = self->text_len;
+    par_job_body((int) (par_job_first + begin), (int) (par_job_first + end - 1), par_job_env);
+    if (self->text_len > mark) {
+        if (self->piece_count == self->piece_cap) {
+            size_t cap = self->piece_cap ? 2 * self->piece_cap : 64;
+            struct par_piece *pieces = realloc(self->pieces, cap * sizeof(*pieces));
+            if (!pieces)
+                par_out_of_memory();
+            self->pieces = pieces;
+            self->piece_cap = cap;
+        }
+        self->pieces[self->piece_count++] = (struct par_piece) {par_job_first + begin, mark, self->text_len - mark};
+    }
+    atomic_fetch_sub(&par_remaining, end - begin);
+}
+
+/* Next chunk from the front of the own part */
+static int par_take(struct par_worker *self, unsigned int *begin, unsigned int *end) {
+    unsigned long long range = atomic_load(&self->range);
+    for (;;) {
+        unsigned int b = (unsigned int) (range >> 32), e = (unsigned int) range;
+        if (b >= e)
+            return 0;
+        unsigned int n = e - b < par_grain ? e - b : par_grain;
+        if (atomic_compare_exchange_weak(&self->range, &range, (unsigned long long) (b + n) << 32 | e)) {
+            *begin = b;
+            *end = b + n;
+            return 1;
+        }
+    }
+}
+
+/* Moves the back half of the part of victim to the (empty) part of self */
+static int par_steal(struct par_worker *self, struct par_worker *victim) {
+    unsigned long long range = atomic_load(&victim->range);
+    for (;;) {
+        unsigned int b = (unsigned int) (range >> 32), e = (unsigned int) range;
+        if (b >= e)
+            return 0;
+        unsigned int mid = b + (e - b) / 2;
+        if (atomic_compare_exchange_weak(&victim->range, &range, (unsigned long long) b << 32 | mid)) {
+            atomic_store(&self->range, (unsigned long long) mid << 32 | e);
+            return 1;
+        }
+    }
+}
+
+/* Runs chunks until every iteration of the current loop has run */
+static void par_work(struct par_worker *self) {
+    int index = (int) (self - par_workers);
+    unsigned int begin, end;
+    par_self = self;
+    while (atomic_load(&par_remaining) > 0) {
+        if (par_take(self, &begin, &end)) {
+            par_run(self, begin, end);
+            continue;
+        }
+        int stolen = 0;
+        for (int i = 1; i < par_threads && !stolen; i++)
+            stolen = par_steal(self, &par_workers[(index + i) % par_threads]);
+        /* The last chunks are still running elsewhere */
+        if (!stolen)
+            sched_yield();
+    }
+    par_self = NULL;
+}
+
+static void *par_thread(void *arg) {
+    struct par_worker *self = arg;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&par_mutex);
+    for (;;) {
+        while (!par_open || seen == par_generation)
+            pthread_cond_wait(&par_start, &par_mutex);
+        seen = par_generation;
+        par_active++;
+        pthread_mutex_unlock(&par_mutex);
+        par_work(self);
+        pthread_mutex_lock(&par_mutex);
+        if (--par_active == 0)
+            pthread_cond_signal(&par_done);
+    }
+    return NULL;
+}
+
+static void par_start_pool(void) {
+    const char *setting = getenv("MILA_THREADS");
+    long threads = setting && *setting ? strtol(setting, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > PAR_MAX_THREADS)
+        threads = PAR_MAX_THREADS;
+    par_threads = 1;
+    for (long i = 1; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, par_thread, &par_workers[i]) != 0)
+            break;
+        pthread_detach(thread);
+        par_threads++;
+    }
+}
+
+static int par_output_compare(const void *a, const void *b) {
+    const struct par_piece *x = a, *y = b;
+    return (x->first > y->first) - (x->first < y->first);
+}
+
+/* Output of the chunks of the loop in the order of their iterations, begin is made an index into texts */
+static void par_merge_output(void) {
+    size_t count = 0;
+    for (int i = 0; i < par_threads; i++)
+        count += par_workers[i].piece_count;
+    if (count == 0)
+        return;
+    struct par_piece *pieces = malloc(count * sizeof(*pieces));
+    const char **texts = malloc(count * sizeof(*texts));
+    if (!pieces || !texts)
+        par_out_of_memory();
+    count = 0;
+    for (int i = 0; i < par_threads; i++) {
+        struct par_worker *worker = &par_workers[i];
+        for (size_t p = 0; p < worker->piece_count; p++) {
+            texts[count] = worker->text + worker->pieces[p].begin;
+            pieces[count] = worker->pieces[p];
+            pieces[count].begin = count;
+            count++;
+        }
+    }
+    qsort(pieces, count, sizeof(*pieces), par_output_compare);
+    for (size_t p = 0; p < count; p++)
+        out_append(texts[pieces[p].begin], pieces[p].len, 0);
+    if (out_line_buffered)
+        out_flush();
+    free(pieces);
+    free(texts);
+    for (int i = 0; i < par_threads; i++)
+        par_workers[i].text_len = par_workers[i].piece_count = 0;
+}
+
+void mila_parallel_for(int first, int last, par_body body, void *env) {
+    if (first > last)
+        return;
+    if (!par_threads)
+        par_start_pool();
+    unsigned long long count = (unsigned long long) ((long long) last - first + 1);
+    if (par_self || par_threads == 1 || count == 1) {
+        body(first, last, env);
+        return;
+    }
+    /* Offsets are 32 bit, only the whole integer range has more iterations */
+    if (count > 0xffffffffull) {
+        mila_parallel_for(first, -1, body, env);
+        mila_parallel_for(0, last, body, env);
+        return;
+    }
+
+    unsigned int n = (unsigned int) count;
+    par_grain = n / ((unsigned int) par_threads * PAR_CHUNKS_PER_THREAD);
+    if (par_grain == 0)
+        par_grain = 1;
+    par_job_body = body;
+    par_job_env = env;
+    par_job_first = first;
+    atomic_store(&par_remaining, n);
+    for (int i = 0; i < par_threads; i++) {
+        unsigned long long begin = count * (unsigned int) i / (unsigned int) par_threads;
+        unsigned long long end = count * (unsigned int) (i + 1) / (unsigned int) par_threads;
+        atomic_store(&par_workers[i].range, begin << 32 | end);
+    }
+
+    pthread_mutex_lock(&par_mutex);
+    par_generation++;
+    par_open = 1;
+    pthread_cond_broadcast(&par_start);
+    pthread_mutex_unlock(&par_mutex);
+
+    par_work(&par_workers[0]);
+
+    /* Threads still on their way out must not see the ranges of the next loop */
+    pthread_mutex_lock(&par_mutex);
+    par_open = 0;
+    while (par_active > 0)
+        pthread_cond_wait(&par_done, &par_mutex);
+    pthread_mutex_unlock(&par_mutex);
+    par_merge_output();
+}
+
+/* Reductions of a parallel loop are combined into the variables of the routine once per chunk, under this lock */
+void mila_parallel_lock(void) {
+    pthread_mutex_lock(&par_reduce_mutex);
+}
+
+void mila_parallel_unlock(void) {
+    pthread_mutex_unlock(&par_reduce_mutex);
+}
+
+/*
+ * Profiling (mila --profile-generate): every instrumented module registers its counters from a constructor,
+ * at exit one line per routine is appended to the profile file, so the counts of several runs add up.
+ * The layout of both structs is generated by the compiler, see Profile.cpp.
+ */
+
+struct mila_profile_function {
+    const char *name;
+    unsigned long long checksum;
+    unsigned int count;
+    unsigned long long *counters;
+};
+
+struct mila_profile_module {
+    const char *path;
+    unsigned int count;
+    const struct mila_profile_function *functions;
+};
+
+static const struct mila_profile_module **profile_modules = NULL;
+static size_t profile_module_count = 0;
+
+static void profile_write(void) {
+    const char *override = getenv("MILA_PROFILE_FILE");
+    for (size_t m = 0; m < profile_module_count; m++) {
+        const struct mila_profile_module *module = profile_modules[m];
+        const char *path = override && *override ? override : module->path;
+        FILE *file = fopen(path, "a");
+        if (!file) {
+            fprintf(stderr, "Cannot write profile %s: %s\n", path, strerror(errno));
+            continue;
+        }
+        for (unsigned int f = 0; f < module->count; f++) {
+            const struct mila_profile_function *function = &module->functions[f];
+            fprintf(file, "%s %llu %u", function->name, function->checksum, function->count);
+            for (unsigned int c = 0; c < function->count; c++)
+                fprintf(file, " %llu", function->counters[c]);
+            fputc('\n', file);
+        }
+        fclose(file);
+    }
+}
+
+void mila_profile_register(const struct mila_profile_module *module) {
+    const struct mila_profile_module **modules =
+        realloc(profile_modules, (profile_module_count + 1) * sizeof(*profile_modules));
+    if (!modules)
+        return;
+    if (!profile_modules)
+        atexit(profile_write);
+    profile_modules = modules;
+    profile_modules[profile_module_count++] = module;
+}
+
+/*
+ * Source profile (mila --profile): routines and loops are regions, each a struct mila_region generated into the
+ * program (see SourceProfile.cpp). Entered regions sit on a stack of frames, so the time of a region is split into
+ * inclusive time and exclusive time, the inclusive time minus that of the regions entered from it. Recursive
+ * activations add to the inclusive time only at the outermost one. A region registers itself when it is entered
+ * for the first time; the report goes to stderr at exit, so the output of the program is left alone.
+ */
+
+struct mila_region {
+    const char *name;
+    unsigned int line;
+    unsigned int depth;              /* activations on the stack */
+    unsigned long long entries;
+    unsigned long long iterations;   /* loops only, counted by the program */
+    unsigned long long inclusive;
+    unsigned long long exclusive;
+    struct mila_region *next;
+};
+
+struct region_frame {
+    struct mila_region *region;
+    unsigned long long start;
+    unsigned long long children;
+};
+
+static struct mila_region *regions = NULL;
+static struct region_frame *region_stack = NULL;
+static size_t region_depth = 0;
+static size_t region_capacity = 0;
+static unsigned long long clock_start_ticks;
+static struct timespec clock_start_time;
+
+/* The cycle counter where there is one, nanoseconds otherwise */
+static inline unsigned long long region_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000000000ull + (unsigned long long) now.tv_nsec;
+#endif
+}
+
+static int region_compare(const void *a, const void *b) {
+    const struct mila_region *x = *(const struct mila_region *const *) a;
+    const struct mila_region *y = *(const struct mila_region *const *) b;
+    return x->exclusive < y->exclusive ? 1 : x->exclusive > y->exclusive ? -1 : 0;
+}
+
+static void region_report(void) {
+    /* Ticks to milliseconds by the wall clock over the whole run */
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ns = (double) (end.tv_sec - clock_start_time.tv_sec) * 1e9 + (double) (end.tv_nsec - clock_start_time.tv_nsec);
+    double ticks = (double) (region_ticks() - clock_start_ticks);
+    double ms_per_tick = ticks > 0 ? ns / ticks / 1e6 : 0;
+
+    size_t count = 0;
+    for (struct mila_region *r = regions; r; r = r->next)
+        count++;
+    struct mila_region **sorted = malloc(count * sizeof(*sorted));
+    if (!sorted)
+        return;
+    count = 0;
+    for (struct mila_region *r = regions; r; r = r->next)
+        sorted[count++] = r;
+    qsort(sorted, count, sizeof(*sorted), region_compare);
+
+    unsigned long long total = 0;
+    for (size_t i = 0; i < count; i++)
+        total += sorted[i]->exclusive;
+    fprintf(stderr, "Mila profile: %.3f ms in %zu regions, sorted by exclusive time\n", (double) total * ms_per_tick, count);
+    fprintf(stderr, "%12s %12s %6s %12s %14s %6s  %s\n", "incl. ms", "excl. ms", "excl.%", "entries", "iterations",
+            "line", "region");
+    for (size_t i = 0; i < count; i++) {
+        const struct mila_region *r = sorted[i];
+        char iterations[24] = "-";
+        if (r->iterations || strchr(r->name, ':'))
+            snprintf(iterations, sizeof(iterations), "%llu", r->iterations);
+        fprintf(stderr, "%12.3f %12.3f %6.1f %12llu %14s %6u  %s\n", (double) r->inclusive * ms_per_tick,
+                (double) r->exclusive * ms_per_tick, total ? 100.0 * (double) r->exclusive / (double) total : 0.0,
+                r->entries, iterations, r->line, r->name);
+    }
+    free(sorted);
+}
+
+static void region_leave_top(unsigned long long now) {
+    struct region_frame *frame = &region_stack[--region_depth];
+    unsigned long long elapsed = now - frame->start;
+    struct mila_region *region = frame->region;
+    region->exclusive += elapsed - frame->children;
+    if (--region->depth == 0)
+        region->inclusive += elapsed;
+    if (region_depth > 0)
+        region_stack[region_depth - 1].children += elapsed;
+}
+
+/* The stack belongs to the thread of the program, routines called from a parallel loop count towards the loop */
+void mila_region_enter(struct mila_region *region) {
+    if (par_self)
+        return;
+    if (region_depth == region_capacity) {
+        size_t capacity = region_capacity ? 2 * region_capacity : 64;
+        struct region_frame *stack = realloc(region_stack, capacity * sizeof(*stack));
+        if (!stack)
+            return;
+        region_stack = stack;
+        region_capacity = capacity;
+    }
+    if (region->entries++ == 0) {
+        if (!regions) {
+            clock_gettime(CLOCK_MONOTONIC, &clock_start_time);
+            clock_start_ticks = region_ticks();
+            atexit(region_report);
+        }
+        region->next = regions;
+        regions = region;
+    }
+    region->depth++;
+    region_stack[region_depth].region = region;
+    region_stack[region_depth].children = 0;
+    region_stack[region_depth++].start = region_ticks();
+}
+
+/* Also leaves the regions entered after this one and not left, the loops an exit jumped out of */
+void mila_region_exit(struct mila_region *region) {
+    if (par_self)
+        return;
+    unsigned long long now = region_ticks();
+    size_t depth = region_depth;
+    while (depth > 0 && region_stack[depth - 1].region != region)
+        depth--;
+    if (depth == 0)
+        return;
+    while (region_depth >= depth)
+        region_leave_top(now);
+}
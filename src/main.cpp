@@ -1,22 +1,115 @@
+#include <algorithm>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <thread>
 
+#include "Batch.hpp"
+#include "CompileServer.hpp"
+#include "CompilerOptions.hpp"
+#include "MemoryReport.hpp"
+#include "ObjectEmitter.hpp"
 #include "Parser.hpp"
+#include "Optimizer.hpp"
+#include "ServerProtocol.hpp"
+#include "TestRunner.hpp"
+#include "TimeReport.hpp"
 
 // Use tutorials in: https://llvm.org/docs/tutorial/
 
 int main (int argc, char *argv[])
 {
+    CompilerOptions options;
+    try {
+        options = parseCompilerOptions(std::vector<std::string>(argv + 1, argv + argc));
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    unsigned optLevel = options.optLevel;
+    unsigned jobs = options.jobs;
+    const std::string &timeReportFormat = options.timeReportFormat;
+
+    if (options.serve)
+        return runCompileServer(options.socketPath.empty() ? server::defaultSocketPath() : options.socketPath);
+
+    // Every input to an object, -j is the size of the thread pool (all cores by default)
+    if (options.batch) {
+        BatchOptions batchOptions;
+        batchOptions.optLevel = optLevel;
+        batchOptions.jobs = jobs ? jobs : std::max(1u, std::thread::hardware_concurrency());
+        batchOptions.outputDir = options.outputDir;
+        batchOptions.interfaceDirs = options.interfaceDirs;
+        batchOptions.debugInfo = options.debugInfo;
+        batchOptions.fastMath = options.fastMath;
+        // The parser's tracing is useless with many programs interleaved
+        std::clog.rdbuf(nullptr);
+        return compileBatch(options.inputs, batchOptions) == 0 ? 0 : 1;
+    }
+
+    // Golden-output tests of testDir, compiled and run in this process
+    if (!options.testDir.empty()) {
+        TestRunOptions testOptions;
+        testOptions.testDir = options.testDir;
+        testOptions.sampleDir = options.sampleDir;
+        testOptions.perf = options.perf;
+        testOptions.optLevel = optLevel;
+        testOptions.jobs = jobs ? jobs : std::max(1u, std::thread::hardware_concurrency());
+        std::clog.rdbuf(nullptr);
+        return runTestDir(testOptions) == 0 ? 0 : 1;
+    }
+
+    Parser parser;
+    parser.setOptions(options);
+    TimeReport timeReport;
+    if (!timeReportFormat.empty()) {
+        parser.setTimeReport(&timeReport);
+        // Tracing every token and node would be most of the measured time
+        std::clog.rdbuf(nullptr);
+    }
+    if (options.memoryReport) {
+        MemoryReport::enable();
+        std::clog.rdbuf(nullptr);
+    }
 
 //    std::cout << "LL1Syntactic analyzer" << std::endl;
 //    std::cout << "---------------------" << std::endl;
-    Parser parser;
     if (!parser.Parse()) {
         return 1;
     }
 
-    parser.Generate().print(llvm::outs(), nullptr);
+    // Objects of the routines instead of IR, one path per line
+    if (!options.incrementalDir.empty()) {
+        if (!options.profileGenerate.empty() || !options.profileUse.empty() || options.sourceProfile) {
+            std::cerr << "Profiles are not supported with --incremental" << std::endl;
+            return 1;
+        }
+        for (const std::string &object : parser.GenerateIncremental(options.incrementalDir, optLevel))
+            llvm::outs() << object << "\n";
+        return 0;
+    }
+
+    llvm::Module & module = parser.Generate();
+    TimeReport *report = timeReportFormat.empty() ? nullptr : &timeReport;
+    if (report)
+        report->addModuleCounts(module, "generated");
+    optimizeModule(module, optLevel, report);
+    if (report && optLevel > 0)
+        report->addModuleCounts(module, "optimised");
+    {
+        TimeReport::Scope scope(report, "emission");
+        if (!options.objectPath.empty())
+            emitObject(module, options.objectPath);
+        else
+            module.print(llvm::outs(), nullptr);
+        llvm::outs().flush();
+    }
 
+    if (timeReportFormat == "json")
+        timeReport.printJson(std::cerr);
+    else if (report)
+        timeReport.printTable(std::cerr);
+    if (options.memoryReport)
+        MemoryReport::print(std::cerr);
     return 0;
 }